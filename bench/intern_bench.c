@@ -0,0 +1,82 @@
+// Measures how interning scales with threads: every thread interns the same
+// set of keys through clox_string(), half of them already interned before
+// the threads start and half raced for, and checks that all threads end up
+// with the same string for each key.
+//
+// Usage: intern_bench [rounds]
+
+#include "clox.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define KEYS 8192
+#define MAX_THREADS 64
+
+static char keys[KEYS][16];
+static size_t lengths[KEYS];
+static size_t rounds = 16;
+
+typedef struct {
+    pthread_t thread;
+    size_t first;
+    Obj *seen[KEYS];
+} Worker;
+
+static Worker workers[MAX_THREADS];
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static void *run_worker(void *arg) {
+    Worker *worker = arg;
+    for (size_t round = 0; round < rounds; round++) {
+        // Threads start at different keys so they don't march in lockstep
+        for (size_t i = 0; i < KEYS; i++) {
+            size_t key = (worker->first + i) % KEYS;
+            worker->seen[key] = clox_string(keys[key], lengths[key]).as.obj;
+        }
+    }
+    return NULL;
+}
+
+static void bench(int threads) {
+    clox_init();
+    for (size_t i = 0; i < KEYS; i += 2) clox_string(keys[i], lengths[i]);
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        workers[i].first = (size_t)i * KEYS / (size_t)threads;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) pthread_join(workers[i].thread, NULL);
+    double elapsed = now() - start;
+
+    size_t mismatches = 0;
+    for (int i = 1; i < threads; i++) {
+        for (size_t key = 0; key < KEYS; key++) {
+            if (workers[i].seen[key] != workers[0].seen[key]) mismatches++;
+        }
+    }
+
+    double ops = (double)threads * (double)rounds * KEYS;
+    printf("%2d threads: %8.2f Mops/s, %6.1f ns/op per thread%s\n", threads,
+           ops / elapsed / 1e6, elapsed * 1e9 * threads / ops,
+           mismatches == 0 ? "" : ", STRINGS DIFFER");
+    clox_free();
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc > 1) rounds = strtoull(argv[1], NULL, 10);
+    for (size_t i = 0; i < KEYS; i++) {
+        lengths[i] = (size_t)snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+    }
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        bench(threads);
+    }
+    return 0;
+}
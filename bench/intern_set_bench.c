@@ -0,0 +1,128 @@
+// Compares the intern set with the general Table it replaced: how many
+// bytes each needs for the same strings, and how long lookups take when
+// the string is there and when it isn't. Both are filled with the same
+// strings in the same order, and a miss has to probe past strings that
+// share its slot, so the miss numbers show what the hash tags save.
+//
+// Usage: intern_set_bench [strings]
+
+#include "intern.h"
+#include "object.h"
+#include "table.h"
+#include <time.h>
+
+#define LOOKUP_ROUNDS 8
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Strings made by hand rather than through copy_str(), which would intern
+// them in vm.strings as well
+static ObjString *make_string(const char *format, size_t i) {
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), format, i);
+    ObjString *string = malloc(sizeof(ObjString));
+    string->obj.type = OBJ_STRING;
+    string->obj.next = NULL;
+    string->length = (size_t)length;
+    string->chars = malloc((size_t)length + 1);
+    memcpy(string->chars, buffer, (size_t)length + 1);
+    string->hash = hash_string(string->chars, string->length);
+    string->interned = true;
+    string->borrowed = false;
+    return string;
+}
+
+static void free_strings(ObjString **strings, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(strings[i]->chars);
+        free(strings[i]);
+    }
+    free(strings);
+}
+
+static double time_table(Table *table, ObjString **keys, size_t count,
+                         size_t *found) {
+    double start = now();
+    for (int round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (size_t i = 0; i < count; i++) {
+            ObjString *key = keys[i];
+            if (table_find_string(table, key->chars, key->length,
+                                  key->hash) != NULL) {
+                (*found)++;
+            }
+        }
+    }
+    return (now() - start) * 1e9 / ((double)count * LOOKUP_ROUNDS);
+}
+
+static double time_set(InternSet *set, ObjString **keys, size_t count,
+                       size_t *found) {
+    double start = now();
+    for (int round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (size_t i = 0; i < count; i++) {
+            ObjString *key = keys[i];
+            if (intern_set_find(set, key->chars, key->length, key->hash) !=
+                NULL) {
+                (*found)++;
+            }
+        }
+    }
+    return (now() - start) * 1e9 / ((double)count * LOOKUP_ROUNDS);
+}
+
+int main(int argc, const char *argv[]) {
+    size_t count = 1 << 20;
+    if (argc > 1) count = strtoull(argv[1], NULL, 10);
+
+    ObjString **strings = malloc(count * sizeof(ObjString *));
+    ObjString **hits = malloc(count * sizeof(ObjString *));
+    ObjString **misses = malloc(count * sizeof(ObjString *));
+    for (size_t i = 0; i < count; i++) {
+        strings[i] = make_string("string-%zu", i);
+        // Equal contents at another address, as a lookup would have them
+        hits[i] = make_string("string-%zu", i);
+        misses[i] = make_string("missing-%zu", i);
+    }
+
+    Table table;
+    InternSet set;
+    init_table(&table);
+    init_intern_set(&set);
+    for (size_t i = 0; i < count; i++) {
+        table_set(&table, strings[i], NIL_VAL);
+        intern_set_add(&set, strings[i]);
+    }
+
+    size_t table_found = 0, set_found = 0;
+    double table_hit = time_table(&table, hits, count, &table_found);
+    double set_hit = time_set(&set, hits, count, &set_found);
+    double table_miss = time_table(&table, misses, count, &table_found);
+    double set_miss = time_set(&set, misses, count, &set_found);
+
+    size_t table_bytes = table.alloc * sizeof(Entry);
+    size_t set_bytes = set.capacity * sizeof(uintptr_t);
+    printf("%zu strings\n", count);
+    printf("table: %10zu bytes, %5.1f ns/hit, %5.1f ns/miss\n", table_bytes,
+           table_hit, table_miss);
+    printf("set  : %10zu bytes, %5.1f ns/hit, %5.1f ns/miss\n", set_bytes,
+           set_hit, set_miss);
+    printf("set uses %.1f%% of the table's memory\n",
+           100.0 * (double)set_bytes / (double)table_bytes);
+    if (table_found != set_found ||
+        table_found != count * LOOKUP_ROUNDS) {
+        printf("LOOKUPS DISAGREE: table found %zu, set found %zu\n",
+               table_found, set_found);
+        return 1;
+    }
+
+    free_table(&table);
+    free_intern_set(&set);
+    free_strings(strings, count);
+    free_strings(hits, count);
+    free_strings(misses, count);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef clox_array_h
+#define clox_array_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// Element-wise instructions on arrays. The reductions over them, sum(),
+// min(), max() and dot(), are natives, see native.h.
+
+bool array_binary(OpCode op, Value a, Value b, Value *result);
+Value array_unary(OpCode op, ObjArray *array);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// Rows that go through each instruction together. Small enough that the
+// vectors of a whole stack stay in cache, and a multiple of SIMD_LANES.
+#define BATCH_ROWS 1024
+
+// One input per row, which scripts read as the global in slot
+typedef struct {
+    u16 slot;
+    ColumnType type;
+    union {
+        const double *numbers;
+        const bool *bools;
+        ObjString *const *strings;
+    } as;
+} Column;
+
+// Evaluates chunk once for each of rows rows, with every column's item for
+// the row in its global, and stores what each row evaluates to in results.
+// Instead of running the chunk row after row, each instruction is applied
+// to a block of BATCH_ROWS rows before the next one runs, on vectors of
+// doubles where the types allow it. Rows the vectors can't handle, such as
+// those with type errors or arrays, are run again on their own by the
+// interpreter, which reports their errors as usual. Every row starts from
+// the globals as they were when the batch started, and they are left that
+// way. Rows that fail get nil, and true in failed unless it is NULL.
+// Returns how many rows failed.
+size_t run_batch(Chunk *chunk, const Column *columns, size_t column_count,
+                 size_t rows, Value *results, bool *failed);
+
+// Evaluates expression over every row of the CSV file at path (stdin if
+// path is NULL) and writes one result per line to stdout. The header names
+// the globals the columns are bound to, and a column is numbers or bools if
+// all its fields are, strings otherwise. Throughput is reported on stderr.
+// Returns the exit code for the process.
+int eval_batch(const char *expression, const char *path);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+#include "common.h"
+
+#define CACHE_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+typedef struct CacheEntry {
+    u32 hash;
+    size_t length;
+    char *source;
+    Chunk chunk;
+    // Everything this entry keeps allocated, counted against the budget
+    size_t bytes;
+    // Least recently used list, from newest to oldest
+    struct CacheEntry *newer, *older;
+} CacheEntry;
+
+// Compiled chunks keyed by the source they were compiled from. Entries
+// are looked up by hash and then compared by content, and the least
+// recently used ones are evicted to keep the total under budget bytes.
+typedef struct {
+    size_t count, alloc;
+    CacheEntry **entries;
+    CacheEntry *newest, *oldest;
+    size_t bytes, budget;
+    u64 hits, misses, evictions;
+} ChunkCache;
+
+void init_cache(ChunkCache *cache, size_t budget);
+void free_cache(ChunkCache *cache);
+void set_cache_budget(ChunkCache *cache, size_t budget);
+Chunk *cache_lookup(ChunkCache *cache, const char *source, size_t length,
+                    u32 hash);
+Chunk *cache_insert(ChunkCache *cache, const char *source, size_t length,
+                    u32 hash, const Chunk *chunk);
+void print_cache_stats(ChunkCache *cache, FILE *file);
+size_t chunk_bytes(Chunk *chunk);
+
+#endif
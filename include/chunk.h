@@ -18,7 +18,36 @@ typedef enum {
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
+    // The global variable instructions take a two byte slot operand, high
+    // byte first
+    OP_GET_GLOBAL,
+    // Assigns the top of the stack to an existing global, leaving it there
+    OP_SET_GLOBAL,
+    // Same, but the global doesn't have to exist yet
+    OP_DEFINE_GLOBAL,
+    OP_POP,
+    // Packs the numbers on top of the stack into an array, the operand
+    // says how many
+    OP_ARRAY,
+    // Calls the native whose index is the operand, see native.h, with the
+    // arguments on top of the stack
+    OP_CALL_NATIVE,
     OP_RETURN,
+    // Specialized forms the generic instructions above rewrite themselves
+    // into at runtime, once they've seen what types their operands have
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+    OP_DIVIDE_INT,
+    OP_GREATER_INT,
+    OP_LESS_INT,
 } OpCode;
 
 // Lines are stored in run-length encoding, which means
@@ -34,11 +63,26 @@ typedef struct {
     u8 *code;
     LineArray lines;
     ValueArray constants;
+    // Translation for the register machine, made the first time the chunk
+    // runs on it
+    struct RegChunk *registers;
+    // Native code, made once the chunk has run vm.jit_threshold times
+    u32 runs;
+    struct JitCode *jit;
+    // Set once the chunk is frozen: code, constants and lines all live in
+    // this one block, which is all there is to free
+    void *block;
+    size_t block_size;
 } Chunk;
 
+// Frozen chunks start on a cache line of their own
+#define CHUNK_ALIGNMENT 64
+
 void init_chunk(Chunk *chunk);
 void free_chunk(Chunk *chunk);
+void reset_chunk(Chunk *chunk);
 void write_chunk(Chunk *chunk, u8 byte, size_t line);
 size_t add_constant(Chunk *chunk, Value value);
+void freeze_chunk(Chunk *frozen, const Chunk *chunk);
 
 #endif
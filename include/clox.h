@@ -0,0 +1,150 @@
+#ifndef clox_h
+#define clox_h
+
+// Public interface of libclox, for embedding the interpreter in another
+// program. Source is prepared once into a program that can then be
+// executed any number of times, with inputs injected as globals and the
+// result handed back as a Value instead of being printed.
+//
+// The header stands on its own, for C and C++ alike: it includes none of
+// the interpreter's headers, which include it instead for the types below.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct CloxProgram CloxProgram;
+// Strings and arrays, only ever handled through the functions below
+typedef struct Obj Obj;
+
+typedef enum {
+    VAL_NIL,
+    VAL_BOOL,
+    VAL_NUMBER,
+    // Integers are kept apart from doubles so that they stay exact, and
+    // become doubles when a result doesn't fit in 64 bits
+    VAL_INT,
+    VAL_OBJ,
+} ValueType;
+
+// A script's value, held in the member of as that type says. Objects are
+// read with clox_string_chars() and clox_array_items().
+typedef struct {
+    ValueType type;
+    union {
+        bool boolean;
+        double number;
+        int64_t integer;
+        Obj *obj;
+    } as;
+} Value;
+
+typedef enum {
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR,
+    // Ran out of fuel, which only scripts run by the scheduler ever do
+    INTERPRET_YIELD,
+} InterpretResult;
+
+typedef enum {
+    COLUMN_NUMBER,
+    COLUMN_BOOL,
+    // NULL strings are nil
+    COLUMN_STRING,
+} ColumnType;
+
+// A C function scripts can call, given exactly as many arguments as it was
+// registered with. Stores what the call evaluates to in result and returns
+// NULL, or returns a message saying what is wrong with the arguments, which
+// the caller reports as a runtime error.
+typedef const char *(*NativeFn)(const Value *args, Value *result);
+
+// Also installs a SIGSEGV handler for overflows of the value stack, which
+// hands any other fault to the handler installed before it
+void clox_init(void);
+void clox_free(void);
+
+// Compiles source, returning NULL if it has errors. The source doesn't
+// need to outlive the program.
+CloxProgram *clox_prepare(const char *source);
+void clox_release(CloxProgram *program);
+
+// Runs program, storing what it evaluates to in result when it succeeds
+InterpretResult clox_execute(CloxProgram *program, Value *result);
+
+// One input of clox_execute_batch(), read by scripts as the global name.
+// items points to a double, a bool or a NUL-terminated string per row,
+// depending on type, and NULL strings are nil.
+typedef struct {
+    const char *name;
+    ColumnType type;
+    const void *items;
+} CloxColumn;
+
+// Runs program once for each of rows rows, with every column's item for
+// the row as its global, storing what each row evaluates to in results.
+// The rows go through the program an instruction at a time together, see
+// batch.h. Rows that fail get nil, and true in failed unless it is
+// NULL. Returns how many rows failed.
+size_t clox_execute_batch(CloxProgram *program, const CloxColumn *columns,
+                          size_t column_count, size_t rows, Value *results,
+                          bool *failed);
+
+// Promises that the length bytes at source stay alive and unchanged until
+// clox_free(), so that programs prepared from them point into them for
+// their string literals and names instead of copying them
+void clox_pin_source(const char *source, size_t length);
+
+// Makes value available to scripts under name, replacing any previous value
+void clox_set_global(const char *name, Value value);
+bool clox_get_global(const char *name, Value *value);
+
+// Lets scripts call function as name with arity arguments, see native.h.
+// Registering the same name and arity again replaces the function, and
+// only programs prepared afterwards can call it. Returns false if arity is
+// over 255 or there are already 256 natives.
+bool clox_register_native(const char *name, int arity, NativeFn function);
+
+// Saves interned strings and cached chunks to path, and loads them back in
+// a later process, see snapshot.h. Loading must happen right after
+// clox_init(), before anything has been prepared or set, and natives have
+// to be registered before it in the same order as when saving.
+bool clox_snapshot_save(const char *path);
+bool clox_snapshot_load(const char *path);
+
+// Writes a JSON census of the heap to file, see dump_heap()
+void clox_heap_dump(FILE *file);
+
+// The flight recorder keeps the last instructions the VM ran, see
+// recorder.h. clox_flight_recorder() makes every runtime error dump them
+// to fd, -1 turns that off again, and clox_flight_recorder_dump() dumps
+// them right away.
+void clox_flight_recorder(int fd);
+void clox_flight_recorder_dump(int fd);
+
+// Constructors for values to inject. clox_string() is safe to call from any thread, and returns the same
+// string for equal contents no matter which thread asks.
+Value clox_nil(void);
+Value clox_bool(bool boolean);
+Value clox_number(double number);
+Value clox_integer(int64_t integer);
+Value clox_string(const char *chars, size_t length);
+// Copies length numbers into a new array
+Value clox_array(const double *items, size_t length);
+// The numbers in an array value, or NULL if value isn't one
+const double *clox_array_items(Value value, size_t *length);
+// The characters of a string value, which aren't always followed by a
+// '\0', or NULL if value isn't one
+const char *clox_string_chars(Value value, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
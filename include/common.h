@@ -9,11 +9,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef CLOX_DEBUG
 #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
+#endif
+
+// Data touched by different threads is kept this far apart
+#define CACHE_LINE 64
 
 typedef uint8_t u8;
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef int32_t i32;
+typedef int64_t i64;
 
 #endif
@@ -3,11 +3,19 @@
 
 #include "chunk.h"
 #include "object.h"
+#include "pipeline.h"
 #include "scanner.h"
 
 typedef struct {
     Token current, previous;
     bool had_error, panic_mode;
+    // Where tokens come from when scanning runs on its own thread, NULL
+    // when the parser calls the scanner itself
+    TokenRing *ring;
+    // Whether the source is pinned, so strings can borrow from it
+    bool borrow;
+    // How many expressions the one being parsed is nested in
+    size_t depth;
 } Parser;
 
 bool compile(const char *source, Chunk *chunk);
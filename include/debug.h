@@ -3,9 +3,12 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "register.h"
 
 void disassemble_chunk(Chunk *chunk, const char *name);
 size_t disassemble_instruction(Chunk *chunk, size_t offset);
+void disassemble_registers(RegChunk *reg_chunk, const char *name);
 size_t get_line(Chunk *chunk, size_t offset);
+const char *opcode_name(u8 op);
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef clox_dtoa_h
+#define clox_dtoa_h
+
+#include "common.h"
+
+// Enough for a sign, 17 significant digits, a decimal point, an exponent
+// and the terminating '\0'
+#define DTOA_BUFFER_SIZE 32
+
+// A double never needs more significant digits than this to round-trip
+#define DTOA_MAX_DIGITS 17
+
+// 2^53, every integer below it is exactly representable
+#define DTOA_EXACT_INTEGER 9007199254740992.0
+
+// Formats value with the shortest digits that parse back to the same
+// double, returning the number of characters written (excluding the '\0')
+size_t format_double(double value, char *buffer);
+
+#endif
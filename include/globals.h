@@ -0,0 +1,43 @@
+#ifndef clox_globals_h
+#define clox_globals_h
+
+#include "common.h"
+#include "table.h"
+#include "value.h"
+
+// Instructions take a two byte slot, which bounds how many there can be
+#define GLOBALS_MAX (UINT16_MAX + 1)
+
+// What an undefined slot holds. No object lives at NULL, so no value a
+// script can make looks like it.
+#define UNDEFINED_VAL OBJ_VAL(NULL)
+#define IS_UNDEFINED(value) (IS_OBJ(value) && AS_OBJ(value) == NULL)
+
+// Global variables live in a dense array of slots. The compiler resolves
+// each name to its slot once, so instructions index the array directly and
+// names are only looked up while compiling and by the embedding API. A
+// slot is made the first time its name is seen, whether that is a script
+// using it or an embedder setting it, and stays undefined until something
+// assigns it, which lets scripts be compiled before their inputs are set.
+typedef struct {
+    // Slot of each name, as an integer Value
+    Table slots;
+    size_t count, alloc;
+    Value *values;
+    // Name of each slot, for error messages
+    ObjString **names;
+} Globals;
+
+// Reads the slot operand of a global variable instruction
+static inline u16 read_slot_operand(const u8 *operand) {
+    return (u16)(operand[0] << 8 | operand[1]);
+}
+
+void init_globals(Globals *globals);
+void free_globals(Globals *globals);
+// Returns the slot for name, adding an undefined one if it has none yet,
+// or -1 once there are GLOBALS_MAX of them
+i32 global_slot(Globals *globals, ObjString *name);
+bool find_global(Globals *globals, ObjString *name, u32 *slot);
+
+#endif
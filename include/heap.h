@@ -0,0 +1,15 @@
+#ifndef clox_heap_h
+#define clox_heap_h
+
+#include "common.h"
+
+#define HEAP_LARGEST_STRINGS 10
+#define HEAP_DUPLICATED_STRINGS 10
+
+// Writes a census of vm.objects and vm.strings to file as a JSON object:
+// counts and bytes per object type, a histogram of string lengths, the
+// intern table's load, the largest strings, and strings whose contents are
+// held more than once. Not safe while other threads are allocating.
+void dump_heap(FILE *file);
+
+#endif
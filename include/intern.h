@@ -0,0 +1,53 @@
+#ifndef clox_intern_h
+#define clox_intern_h
+
+#include "common.h"
+#include "value.h"
+#include <pthread.h>
+
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+
+// Slots hold a string's address in their low INTERN_TAG_SHIFT bits and a
+// tag made from its hash in the bits above, which user-space addresses on
+// x86-64 and AArch64 leave clear
+#define INTERN_TAG_SHIFT 48
+#define INTERN_ADDRESS_MASK (((uintptr_t)1 << INTERN_TAG_SHIFT) - 1)
+
+// An open-addressing set of interned strings, one pointer-sized slot per
+// string. Probes compare the tag before following the pointer, so slots
+// holding other strings rarely cost a cache miss. Interned strings are
+// never removed, which means there are no tombstones and an empty slot
+// always ends a probe sequence.
+typedef struct {
+    size_t count, capacity;
+    uintptr_t *slots;
+} InternSet;
+
+// A set of interned strings guarded by its own lock. Each shard sits on
+// its own cache lines so that threads working on different shards don't
+// contend for them.
+typedef struct {
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    InternSet set;
+} InternShard;
+
+// The canonical copy of every interned string, shared by all threads.
+// Strings are spread over the shards by hash, and a string is only ever
+// looked up or added with its shard locked, so that two threads interning
+// equal strings end up with the same object.
+typedef struct {
+    InternShard shards[INTERN_SHARDS];
+} InternTable;
+
+void init_intern_table(InternTable *strings);
+void free_intern_table(InternTable *strings);
+InternShard *intern_shard(InternTable *strings, u32 hash);
+void init_intern_set(InternSet *set);
+void free_intern_set(InternSet *set);
+ObjString *intern_set_find(InternSet *set, const char *chars, size_t length,
+                           u32 hash);
+// string must not be in the set yet
+void intern_set_add(InternSet *set, ObjString *string);
+
+#endif
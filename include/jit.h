@@ -0,0 +1,19 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// Native code for a chunk, made by stitching together a machine code
+// template for each of its instructions
+typedef struct JitCode {
+    void *code;
+    size_t size, mapped;
+} JitCode;
+
+JitCode *jit_compile(Chunk *chunk);
+InterpretResult jit_run(JitCode *jit);
+void free_jit(JitCode *jit);
+
+#endif
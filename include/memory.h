@@ -17,7 +17,18 @@
 
 #define FREE_ARRAY(type, pointer, alloc) reallocate(pointer, 0)
 
+// Small, fixed-size allocations that come from the VM's slab. They must be
+// freed with the same count they were allocated with, and are all released
+// at once by free_VM()
+#define ALLOCATE_SMALL(type, count)                                            \
+    (type *)allocate_small(sizeof(type) * (count))
+
+#define FREE_SMALL(type, pointer, count)                                       \
+    free_small(pointer, sizeof(type) * (count))
+
 void *reallocate(void *pointer, size_t new_size);
+void *allocate_small(size_t size);
+void free_small(void *pointer, size_t size);
 void free_objects(void);
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "common.h"
+#include "value.h"
+
+// OP_CALL_NATIVE takes a one byte index into the registry
+#define NATIVES_MAX (UINT8_MAX + 1)
+
+typedef struct {
+    char *name;
+    size_t length;
+    u8 arity;
+    NativeFn function;
+} Native;
+
+// Functions scripts can call by name. The compiler resolves a call to the
+// index of the native with that name and number of arguments, so one name
+// can have several arities, and the instruction calls through the table
+// without a frame or any lookup. The registry starts out with the built-in
+// math, string and array functions.
+typedef struct {
+    size_t count, alloc;
+    Native *items;
+} Natives;
+
+void init_natives(Natives *natives);
+void free_natives(Natives *natives);
+// Registers function as name with arity arguments, replacing the one that
+// already has that name and arity. Returns false once there are
+// NATIVES_MAX of them.
+bool define_native(Natives *natives, const char *name, u8 arity,
+                   NativeFn function);
+// Returns the index of the native called name that takes arity arguments,
+// or -1, setting *named if there is one by that name with another arity
+i32 find_native(Natives *natives, const char *name, size_t length, int arity,
+                bool *named);
+// Changes whenever a name, an arity or the order of the natives does,
+// since compiled chunks refer to them by index
+u64 natives_fingerprint(Natives *natives);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// Arithmetic on integers that gives up on exactness only when it has to:
+// results that don't fit in 64 bits are computed again as doubles
+
+static inline Value int_add(i64 a, i64 b) {
+    i64 result;
+    if (__builtin_add_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a + (double)b);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value int_subtract(i64 a, i64 b) {
+    i64 result;
+    if (__builtin_sub_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a - (double)b);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value int_multiply(i64 a, i64 b) {
+    i64 result;
+    if (__builtin_mul_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a * (double)b);
+    }
+    return INT_VAL(result);
+}
+
+// Only exact quotients stay integers, 7 / 2 is 3.5
+static inline Value int_divide(i64 a, i64 b) {
+    if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) {
+        return NUMBER_VAL((double)a / (double)b);
+    }
+    return INT_VAL(a / b);
+}
+
+static inline Value int_negate(i64 a) {
+    if (a == INT64_MIN) return NUMBER_VAL(-(double)a);
+    return INT_VAL(-a);
+}
+
+// The result of an arithmetic or comparison instruction on two numbers of
+// either kind. Integers stay integers when both operands are, anything
+// else is done in doubles.
+static inline Value number_binary(OpCode op, Value a, Value b) {
+    if (IS_INT(a) && IS_INT(b)) {
+        i64 x = AS_INT(a), y = AS_INT(b);
+        switch (op) {
+        case OP_ADD     : return int_add(x, y);
+        case OP_SUBTRACT: return int_subtract(x, y);
+        case OP_MULTIPLY: return int_multiply(x, y);
+        case OP_DIVIDE  : return int_divide(x, y);
+        case OP_GREATER : return BOOL_VAL(x > y);
+        default         : return BOOL_VAL(x < y);
+        }
+    }
+
+    double x = as_double(a), y = as_double(b);
+    switch (op) {
+    case OP_ADD     : return NUMBER_VAL(x + y);
+    case OP_SUBTRACT: return NUMBER_VAL(x - y);
+    case OP_MULTIPLY: return NUMBER_VAL(x * y);
+    case OP_DIVIDE  : return NUMBER_VAL(x / y);
+    case OP_GREATER : return BOOL_VAL(x > y);
+    default         : return BOOL_VAL(x < y);
+    }
+}
+
+static inline Value number_negate(Value a) {
+    return IS_INT(a) ? int_negate(AS_INT(a)) : NUMBER_VAL(-AS_NUMBER(a));
+}
+
+#endif
@@ -7,12 +7,15 @@
 #define TYPEOF_OBJ(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_ARRAY(value) is_obj_type(value, OBJ_ARRAY)
 
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_ARRAY(value) ((ObjArray *)AS_OBJ(value))
 
 typedef enum {
     OBJ_STRING,
+    OBJ_ARRAY,
 } ObjType;
 
 struct Obj {
@@ -25,10 +28,34 @@ struct ObjString {
     size_t length;
     char *chars;
     u32 hash;
+    // Whether this is the copy in vm.strings. Strings made at runtime, such
+    // as concatenations, are left out, and only interned strings are ever
+    // used as table keys.
+    bool interned;
+    // Whether chars point into a buffer the string doesn't own, a pinned
+    // source or a snapshot image, rather than a copy of its own. Borrowed
+    // characters aren't freed with the string and may not be followed by
+    // a '\0'.
+    bool borrowed;
 };
 
-ObjString *take_str(char *chars, size_t length);
+// Numbers packed into a buffer aligned for the SIMD kernels, zeroed from
+// length up to padded so that kernels can run over whole vectors
+struct ObjArray {
+    Obj obj;
+    size_t length, padded;
+    double *items;
+};
+
+u32 hash_string(const char *key, size_t length);
+u32 hash_continue(u32 hash, const char *key, size_t length);
 ObjString *copy_str(const char *string, size_t length);
+ObjString *borrow_str(const char *chars, size_t length);
+ObjString *concat_str(ObjString *a, ObjString *b);
+bool str_equal(ObjString *a, ObjString *b);
+ObjArray *new_array(size_t length);
+ObjArray *copy_array(const double *items, size_t length);
+bool array_equal(ObjArray *a, ObjArray *b);
 void print_obj(Value value);
 
 static inline bool is_obj_type(Value value, ObjType type) {
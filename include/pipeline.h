@@ -0,0 +1,30 @@
+#ifndef clox_pipeline_h
+#define clox_pipeline_h
+
+#include "common.h"
+#include "scanner.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Must be a power of two
+#define TOKEN_RING_SIZE 4096
+
+// Tokens scanned on a thread of their own, handed to the parser through a
+// single-producer single-consumer ring. head is only written by the
+// scanner and tail only by the parser, each on its own cache line.
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    _Alignas(CACHE_LINE) atomic_bool stop;
+    pthread_t thread;
+    // Handed out again for every read past the end, like scan_token() does
+    bool at_eof;
+    Token eof;
+    Token tokens[TOKEN_RING_SIZE];
+} TokenRing;
+
+TokenRing *start_pipeline(const char *source);
+Token next_token(TokenRing *ring);
+void stop_pipeline(TokenRing *ring);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef clox_probes_h
+#define clox_probes_h
+
+// Static tracepoints under the "clox" provider, for bpftrace or perf probe.
+// With <sys/sdt.h> available each probe is a nop instruction plus a note in
+// the binary, so it costs nothing until a tracer attaches to it. Without
+// it, or with CLOX_NO_PROBES defined, the probes compile away entirely.
+//
+//   dispatch(offset, opcode)              every instruction run() executes
+//   reallocate(pointer, new_size)         every call to reallocate()
+//   allocate_obj(object, type, size)      every new object
+//   intern_hit(chars, length)             string already interned
+//   intern_miss(chars, length)            string interned for the first time
+//   resize_table(table, old, new)         a Table growing its entries
+//   resize_intern_set(set, old, new)      an intern shard growing its slots
+//   compile_start(source)                 compile() starting
+//   compile_end(source, ok)               compile() done, ok is 0 on errors
+
+#if defined(__has_include) && !defined(CLOX_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CLOX_PROBES
+#endif
+#endif
+
+#ifdef CLOX_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(clox, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(clox, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(clox, name, a, b, c)
+#else
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif
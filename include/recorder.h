@@ -0,0 +1,66 @@
+#ifndef clox_recorder_h
+#define clox_recorder_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// Records kept, a power of two
+#define RECORDER_SIZE 256
+
+// One instruction as it was about to run. The value is the top of the
+// stack, or the first operand on the register machine, and nil when there
+// is none.
+typedef struct {
+    const Chunk *chunk;
+    u32 offset;
+    // Values on the stack, 0 on the register machine
+    u32 depth;
+    u8 op;
+    Value top;
+} Record;
+
+// Flight recorder: a ring of the last instructions the interpreters ran,
+// written on every dispatch without formatting anything, and only turned
+// into text when something goes wrong. Native code from the JIT isn't
+// recorded. Define CLOX_NO_RECORDER to compile the recording out.
+typedef struct {
+    Record records[RECORDER_SIZE];
+    // Instructions recorded so far, the next one goes in count % size
+    u64 count;
+    // Where runtime errors dump the records, -1 to not dump them
+    int fd;
+} Recorder;
+
+#ifdef CLOX_NO_RECORDER
+#define RECORD(recorder, chunk, offset, depth, top) ((void)0)
+#else
+#define RECORD(recorder, chunk, offset, depth, top)                            \
+    record(recorder, chunk, offset, depth, top)
+#endif
+
+static inline void record(Recorder *recorder, const Chunk *chunk,
+                          size_t offset, size_t depth, Value top) {
+    Record *entry =
+        &recorder->records[recorder->count++ & (RECORDER_SIZE - 1)];
+    entry->chunk = chunk;
+    entry->offset = (u32)offset;
+    entry->op = chunk->code[offset];
+    entry->depth = (u32)depth;
+    entry->top = top;
+}
+
+void init_recorder(Recorder *recorder);
+// Writes the records to fd oldest first, headed by reason. Only uses
+// async-signal-safe calls, so it can run in a signal handler. Lines are
+// only resolved for records of the chunk being run, the others may be
+// from chunks that have been freed since.
+void dump_recorder(Recorder *recorder, int fd, const char *reason);
+// Dumps vm.recorder when the process gets a fatal signal, before passing
+// the signal on to whatever handled it before, and on SIGUSR1, after
+// which it carries on. Dumps go to vm.recorder.fd, or stderr without one.
+// The handlers run on an alternate signal stack, which this installs for
+// the calling thread if it has none, so running out of stack gets a dump.
+void install_recorder_handlers(void);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef clox_register_h
+#define clox_register_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+typedef enum {
+    ROP_NOT,
+    ROP_NEGATE,
+    ROP_EQUAL,
+    ROP_GREATER,
+    ROP_LESS,
+    ROP_ADD,
+    ROP_SUBTRACT,
+    ROP_MULTIPLY,
+    ROP_DIVIDE,
+    // Globals are addressed by slot instead of register: GET_GLOBAL loads
+    // slot b into a, the others store register b into slot a
+    ROP_GET_GLOBAL,
+    ROP_SET_GLOBAL,
+    ROP_DEFINE_GLOBAL,
+    ROP_RETURN,
+} RegOpCode;
+
+// Three address instruction, registers[a] = registers[b] op registers[c]
+typedef struct {
+    u8 op;
+    u16 a, b, c;
+} RegInstruction;
+
+// A chunk translated for the register machine. The register file starts
+// with the chunk's constants followed by nil, true and false, so operands
+// never have to be loaded into a register before use. The rest of the
+// registers hold intermediate results.
+typedef struct RegChunk {
+    size_t count;
+    RegInstruction *code;
+    // Offset of the stack instruction each instruction was translated from,
+    // to find its line when reporting errors
+    size_t *offsets;
+    size_t register_count;
+    Value *registers;
+} RegChunk;
+
+RegChunk *compile_registers(Chunk *chunk);
+void free_reg_chunk(RegChunk *reg_chunk);
+
+#endif
@@ -9,6 +9,8 @@ typedef enum {
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
     TOKEN_DOT,
     TOKEN_MINUS,
@@ -55,6 +57,11 @@ typedef struct {
     const char *start;
     int length;
     int line;
+    // Value of a TOKEN_NUMBER, parsed by the scanner. Literals without a
+    // fraction that fit in 64 bits are integers, the rest doubles.
+    bool integral;
+    i64 integer;
+    double number;
 } Token;
 
 typedef struct {
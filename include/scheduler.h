@@ -0,0 +1,43 @@
+#ifndef clox_scheduler_h
+#define clox_scheduler_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// A script that runs in slices. Between slices its position and what it
+// had on the stack are kept here, and copied back onto the VM's stack when
+// its next slice starts.
+typedef struct {
+    size_t id;
+    Chunk chunk;
+    u8 *ip;
+    ValueArray stack;
+    // The task's own values for the global slots, copied from the VM's
+    // when it was spawned and run on in place of them, so that tasks never
+    // see each other's assignments
+    ValueArray globals;
+    // How the last slice ended, and what the script evaluated to once it
+    // finished with INTERPRET_OK
+    InterpretResult status;
+    Value result;
+    u64 slices;
+} Task;
+
+// Runs tasks round-robin on the calling thread, each for at most quantum
+// instructions at a time, 0 meaning until they finish
+typedef struct {
+    size_t count, alloc;
+    Task **tasks;
+    size_t next;
+    u64 quantum;
+} Scheduler;
+
+void init_scheduler(Scheduler *scheduler, u64 quantum);
+void free_scheduler(Scheduler *scheduler);
+Task *spawn_task(Scheduler *scheduler, size_t id, const char *source);
+Task *run_slice(Scheduler *scheduler);
+void free_task(Task *task);
+
+#endif
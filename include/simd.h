@@ -0,0 +1,43 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+// Kernels work on buffers aligned to SIMD_ALIGNMENT bytes whose length is
+// padded to a multiple of SIMD_LANES, so that the element-wise ones never
+// need a scalar tail
+#define SIMD_ALIGNMENT 64
+#define SIMD_LANES (SIMD_ALIGNMENT / sizeof(double))
+
+typedef enum {
+    SIMD_ADD,
+    SIMD_SUBTRACT,
+    SIMD_MULTIPLY,
+    SIMD_DIVIDE,
+    // 1.0 where the comparison holds and 0.0 where it doesn't
+    SIMD_GREATER,
+    SIMD_LESS,
+} SimdOp;
+
+typedef enum {
+    SIMD_NEGATE,
+    // 1.0 where the element is 0.0 and 0.0 everywhere else
+    SIMD_NOT,
+} SimdUnaryOp;
+
+// padded is the padded length. An operand whose scalar flag is set is a
+// single number repeated over one padded block of SIMD_LANES elements.
+void simd_binary(SimdOp op, double *out, const double *a, bool a_scalar,
+                 const double *b, bool b_scalar, size_t padded);
+void simd_unary(SimdUnaryOp op, double *out, const double *a, size_t padded);
+
+// Reductions take the real length, padding is never read
+double simd_sum(const double *a, size_t length);
+double simd_min(const double *a, size_t length);
+double simd_max(const double *a, size_t length);
+double simd_dot(const double *a, const double *b, size_t length);
+
+// Name of the instruction set the kernels run on
+const char *simd_level(void);
+
+#endif
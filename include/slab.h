@@ -0,0 +1,55 @@
+#ifndef clox_slab_h
+#define clox_slab_h
+
+#include "common.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Blocks are handed out in multiples of SLAB_GRANULE bytes, up to
+// SLAB_MAX. Anything larger goes straight to reallocate().
+#define SLAB_GRANULE 16
+#define SLAB_MAX 256
+#define SLAB_CLASSES (SLAB_MAX / SLAB_GRANULE)
+#define SLAB_PAGE_SIZE (64 * 1024)
+
+typedef struct SlabPage {
+    struct SlabPage *next;
+} SlabPage;
+
+typedef struct SlabBlock {
+    struct SlabBlock *next;
+} SlabBlock;
+
+// The part of a size class each thread keeps to itself: the blocks it
+// freed, and what is left of the page it is carving new blocks off
+typedef struct {
+    SlabBlock *free;
+    u8 *next, *end;
+} SlabCache;
+
+// Every block of a class has the same size. Blocks come from the calling
+// thread's cache, freed blocks first, and a new page is only taken from
+// the shared list once the cache runs dry.
+typedef struct {
+    SlabPage *pages;
+    size_t page_count;
+    // Blocks currently handed out, and the most there ever were at once
+    atomic_size_t live, peak;
+} SizeClass;
+
+// Each thread caches blocks of a single slab, meant to be the VM's
+typedef struct {
+    // Guards the page lists
+    pthread_mutex_t lock;
+    // Tells threads that their cache belongs to a slab that was freed
+    u64 generation;
+    SizeClass classes[SLAB_CLASSES];
+} Slab;
+
+void init_slab(Slab *slab);
+void free_slab(Slab *slab);
+void *slab_alloc(Slab *slab, size_t size);
+void slab_free(Slab *slab, void *pointer, size_t size);
+void print_slab_stats(Slab *slab, FILE *file);
+
+#endif
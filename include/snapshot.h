@@ -0,0 +1,25 @@
+#ifndef clox_snapshot_h
+#define clox_snapshot_h
+
+#include "common.h"
+
+// Bumped whenever the image layout changes in a way the layout fingerprint
+// in the header can't catch
+#define SNAPSHOT_VERSION 5
+
+// A snapshot is an image of the interned strings, the chunk cache and the
+// global slots the cached chunks refer to, which a later run maps back in
+// instead of rebuilding them. Only the names of the slots are kept, so
+// globals start out undefined as usual. Pointers in the image are stored
+// as offsets from its start and listed in a fixup table, so the image can
+// be mapped anywhere and relocated with one pass over that table. Images
+// are only valid for the build that wrote them, with the same natives
+// registered in the same order.
+bool write_snapshot(const char *path);
+// Must be called before anything has been interned, cached or given a
+// global slot. Strings and arrays stay in the mapping until free_VM(), the
+// intern tables, cached chunks and global slots are copied out of it.
+bool load_snapshot(const char *path);
+void free_snapshot(void);
+
+#endif
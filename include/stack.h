@@ -0,0 +1,40 @@
+#ifndef clox_stack_h
+#define clox_stack_h
+
+#include "common.h"
+#include "value.h"
+#include <setjmp.h>
+#include <signal.h>
+
+// Values the stack has room for, 16 MB of address space. Only the pages
+// the stack has actually reached are backed by memory.
+#ifndef STACK_RESERVE
+#define STACK_RESERVE ((size_t)1 << 20)
+#endif
+
+// The VM's value stack, mapped with a page that can't be accessed right
+// after its last value. push() never checks for room: a push past the end
+// faults on that page, and the SIGSEGV handler jumps back to overflow,
+// which the VM turns into a runtime error.
+typedef struct {
+    Value *values;
+    size_t capacity;
+    u8 *guard;
+    size_t page_size;
+    // Where an overflow jumps to, only valid while armed is set
+    sigjmp_buf overflow;
+    volatile sig_atomic_t armed;
+} ValueStack;
+
+void init_value_stack(ValueStack *stack, size_t capacity);
+void free_value_stack(ValueStack *stack);
+// Gives back the memory behind every page past the first, once an
+// overflow has touched all of them and nothing is left on the stack
+void trim_value_stack(ValueStack *stack);
+// Installs the SIGSEGV handler for overflows of vm's stack, which passes
+// any other fault on to the handler installed before it. Later calls do
+// nothing, and handlers installed afterwards have to pass faults on to it
+// for overflows to be caught, so this goes after the process's own.
+void install_stack_guard(void);
+
+#endif
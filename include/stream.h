@@ -0,0 +1,12 @@
+#ifndef clox_stream_h
+#define clox_stream_h
+
+#include "common.h"
+
+// Evaluates one expression per line of the file at path (stdin if path is
+// NULL), writing one result per line to stdout. Throughput and latency
+// figures are reported on stderr once the input runs out. Returns the exit
+// code for the process.
+int eval_stream(const char *path);
+
+#endif
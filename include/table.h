@@ -9,6 +9,7 @@ typedef struct {
     Value value;
 } Entry;
 
+// Keys are compared by address, so they must be interned strings
 typedef struct {
     size_t count, alloc;
     Entry *entries;
@@ -1,39 +1,29 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include "clox.h"
 #include "common.h"
 
-typedef struct Obj Obj;
 typedef struct ObjString ObjString;
-
-typedef enum {
-    VAL_NIL,
-    VAL_BOOL,
-    VAL_NUMBER,
-    VAL_OBJ,
-} ValueType;
-
-typedef struct {
-    ValueType type;
-    union {
-        bool boolean;
-        double number;
-        Obj *obj;
-    } as;
-} Value;
+typedef struct ObjArray ObjArray;
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
 #define AS_OBJ(value) ((value).as.obj)
 
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 #define OBJ_VAL(value) ((Value){VAL_OBJ, {.obj = value}})
 
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
+// Either kind of number, wherever the two mix
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 typedef struct {
@@ -41,6 +31,14 @@ typedef struct {
     Value *items;
 } ValueArray;
 
+static inline double as_double(Value value) {
+    return IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value);
+}
+
+static inline bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
 bool values_equal(Value a, Value b);
 void init_ValueArray(ValueArray *array);
 void free_ValueArray(ValueArray *array);
@@ -1,31 +1,107 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include "cache.h"
 #include "chunk.h"
 #include "common.h"
+#include "globals.h"
+#include "intern.h"
+#include "native.h"
+#include "recorder.h"
+#include "slab.h"
+#include "stack.h"
 #include "table.h"
 #include "value.h"
+#include "writer.h"
+#include <stdatomic.h>
 
-#define STACK_MAX 256
+// Fuel that never runs out in practice, so that counting it down needs no
+// separate check for whether it is being metered at all
+#define FUEL_UNLIMITED UINT64_MAX
+
+typedef enum {
+    BACKEND_STACK,
+    BACKEND_REGISTER,
+} Backend;
+
+typedef struct {
+    // Instructions dispatched by either machine
+    u64 dispatches;
+    // Instructions rewritten into a specialized form, executions of a
+    // specialized instruction, and specialized instructions that had to
+    // fall back to the generic one
+    u64 quickened, quick_hits, deopts;
+    // Chunks translated to native code, and runs of native code
+    u64 jit_compiles, jit_runs;
+    // Times run() ran out of fuel and returned before finishing
+    u64 yields;
+    // Runs of chunks the register machine can't translate, which went to
+    // the stack machine instead, and the instructions it dispatched for them
+    u64 register_fallbacks, fallback_dispatches;
+    // Rows run_batch() evaluated as vectors, and rows it had to hand to
+    // the interpreter one at a time
+    u64 batch_rows, batch_fallbacks;
+} VMStats;
+
+// A buffer that lives until free_VM(), which string literals and names
+// compiled from it borrow their characters from instead of copying them
+typedef struct {
+    const char *start;
+    size_t length;
+    // Released with free() by free_VM(), rather than by whoever pinned it
+    bool owned;
+} PinnedSource;
 
 typedef struct {
     Chunk *chunk;
     u8 *ip;
-    Value stack[STACK_MAX];
+    // The bottom of value_stack, and one past its top
+    Value *stack;
     Value *stack_top;
-    Table strings;
-    Obj *objects;
+    ValueStack value_stack;
+    // Instructions run() may still dispatch before it has to yield
+    u64 fuel;
+    // Shared by every thread that makes strings
+    InternTable strings;
+    // Global variables, defined by scripts or injected by the embedder
+    Globals globals;
+    // Functions scripts can call, built in or registered by the embedder
+    Natives natives;
+    // What the last chunk that ran to completion evaluated to
+    Value result;
+    _Atomic(Obj *) objects;
+    // Where objects and small strings are allocated from
+    Slab slab;
+    Writer out;
+    ChunkCache cache;
+    VMStats stats;
+    Backend backend;
+    // Runs after which a chunk is compiled to native code, 0 to never
+    u32 jit_threshold;
+    bool jit_perf_map;
+    // Sources at least this long are scanned on a separate thread while
+    // they are parsed, 0 to never
+    size_t pipeline_threshold;
+    // The image mapped in by load_snapshot(), which the strings it holds
+    // point into
+    void *snapshot;
+    size_t snapshot_size;
+    size_t pinned_count, pinned_alloc;
+    PinnedSource *pinned;
+    Recorder recorder;
 } VM;
 
-typedef enum {
-    INTERPRET_OK,
-    INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR,
-} InterpretResult;
-
 void init_VM(void);
 void free_VM(void);
 InterpretResult interpret(const char *source);
+InterpretResult run_chunk(Chunk *chunk);
+InterpretResult resume(void);
+void print_vm_stats(FILE *file);
+InterpretResult interpret_in(Chunk *chunk, const char *source);
+void vm_error(const char *format, ...);
+void undefined_variable(u16 slot);
+void pin_source(const char *source, size_t length, bool owned);
+bool source_pinned(const char *source);
 void push(Value value);
 Value pop();
 
@@ -0,0 +1,30 @@
+#ifndef clox_writer_h
+#define clox_writer_h
+
+#include "common.h"
+
+#define WRITER_CAPACITY 8192
+
+// Buffered output, so that printing a value doesn't cost a trip through
+// stdio for every piece of it. Everything written is handed to the FILE
+// in one go when the buffer fills up or the writer is flushed.
+typedef struct {
+    FILE *file;
+    size_t count;
+    char buffer[WRITER_CAPACITY];
+} Writer;
+
+void init_writer(Writer *writer, FILE *file);
+void flush_writer(Writer *writer);
+void write_bytes(Writer *writer, const char *bytes, size_t length);
+void write_cstr(Writer *writer, const char *string);
+void write_number(Writer *writer, double number);
+void write_int(Writer *writer, i64 integer);
+void write_fmt(Writer *writer, const char *format, ...);
+
+static inline void write_char(Writer *writer, char c) {
+    if (writer->count == WRITER_CAPACITY) flush_writer(writer);
+    writer->buffer[writer->count++] = c;
+}
+
+#endif
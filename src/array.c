@@ -0,0 +1,70 @@
+#include "array.h"
+#include "chunk.h"
+#include "common.h"
+#include "object.h"
+#include "simd.h"
+#include "value.h"
+#include "vm.h"
+
+static SimdOp simd_op(OpCode op) {
+    switch (op) {
+    case OP_ADD     : return SIMD_ADD;
+    case OP_SUBTRACT: return SIMD_SUBTRACT;
+    case OP_MULTIPLY: return SIMD_MULTIPLY;
+    case OP_DIVIDE  : return SIMD_DIVIDE;
+    case OP_GREATER : return SIMD_GREATER;
+    default         : return SIMD_LESS;
+    }
+}
+
+// Kernels read a whole padded block of a scalar operand
+static const double *splat(double *block, Value value) {
+    for (size_t i = 0; i < SIMD_LANES; i++) block[i] = as_double(value);
+    return block;
+}
+
+// Padding is zeroed again after a kernel ran over it, 0 / 0 and !0 don't
+// leave it that way
+static Value finish(ObjArray *array) {
+    memset(array->items + array->length, 0,
+           (array->padded - array->length) * sizeof(double));
+    return OBJ_VAL((Obj *)array);
+}
+
+// Applies an arithmetic or comparison instruction element-wise, where one
+// operand is an array and the other is an array of the same length or a
+// number that is used for every element. Comparisons give arrays of 1 and
+// 0. Errors are reported through vm_error(), with vm.ip pointing just past
+// the instruction, and false is returned.
+bool array_binary(OpCode op, Value a, Value b, Value *result) {
+    if ((!IS_ARRAY(a) && !IS_NUMERIC(a)) || (!IS_ARRAY(b) && !IS_NUMERIC(b))) {
+        vm_error("Operands must be numbers or arrays.");
+        return false;
+    }
+    if (IS_ARRAY(a) && IS_ARRAY(b) &&
+        AS_ARRAY(a)->length != AS_ARRAY(b)->length) {
+        vm_error("Arrays must have the same length.");
+        return false;
+    }
+
+    _Alignas(SIMD_ALIGNMENT) double a_block[SIMD_LANES];
+    _Alignas(SIMD_ALIGNMENT) double b_block[SIMD_LANES];
+    ObjArray *shape = IS_ARRAY(a) ? AS_ARRAY(a) : AS_ARRAY(b);
+    ObjArray *out = new_array(shape->length);
+    simd_binary(simd_op(op), out->items,
+                IS_ARRAY(a) ? AS_ARRAY(a)->items : splat(a_block, a),
+                !IS_ARRAY(a),
+                IS_ARRAY(b) ? AS_ARRAY(b)->items : splat(b_block, b),
+                !IS_ARRAY(b), out->padded);
+    *result = finish(out);
+    return true;
+}
+
+// Negation, or a logical not that gives 1 where elements are 0 and 0
+// everywhere else
+Value array_unary(OpCode op, ObjArray *array) {
+    ObjArray *out = new_array(array->length);
+    simd_unary(op == OP_NEGATE ? SIMD_NEGATE : SIMD_NOT, out->items,
+               array->items, out->padded);
+    return finish(out);
+}
@@ -0,0 +1,804 @@
+#include "batch.h"
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "globals.h"
+#include "memory.h"
+#include "native.h"
+#include "number.h"
+#include "object.h"
+#include "simd.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+extern VM vm;
+
+#define READ_SIZE 65536
+// Deepest stack a chunk may need to run as vectors, since every slot has
+// lanes for a whole block. Deeper ones run a row at a time.
+#define BATCH_DEPTH_MAX 256
+
+typedef enum {
+    // A double per row
+    VECTOR_NUMBER,
+    // A double per row that is 1.0 where the row is true, which is what
+    // the comparison kernels leave behind
+    VECTOR_BOOL,
+    // A value of any type per row
+    VECTOR_VALUE,
+    // The same value for every row, which is never spread out
+    VECTOR_CONSTANT,
+} VectorKind;
+
+// What one stack slot holds for every row of a block
+typedef struct {
+    VectorKind kind;
+    Value constant;
+    const double *numbers;
+    const Value *values;
+} Vector;
+
+// Buffers a vector's rows are written to, allocated the first time they
+// are needed
+typedef struct {
+    double *numbers;
+    Value *values;
+} Lanes;
+
+// A global the script assigned in the current block, which shadows its
+// column or value for the rest of the block
+typedef struct {
+    bool assigned;
+    Vector vector;
+    Lanes lanes;
+} Binding;
+
+typedef struct {
+    Chunk *chunk;
+    const Column *columns;
+    size_t column_count;
+    // The current block is rows rows starting at row first of the batch,
+    // and padded is rows rounded up to whole SIMD_LANES
+    size_t first, rows, padded;
+    Vector stack[BATCH_DEPTH_MAX];
+    Lanes lanes[BATCH_DEPTH_MAX];
+    // Indexed by global slot, the column bound to each, or NULL
+    size_t slots;
+    const Column **bound;
+    Binding *bindings;
+    // Rows the vectors gave up on, to be run again by the interpreter
+    bool failed[BATCH_ROWS];
+} Batch;
+
+typedef struct {
+    size_t count, alloc;
+    char **items;
+} FieldArray;
+
+static OpCode generic_op(u8 instruction) {
+    switch (instruction) {
+    case OP_ADD_NUM     :
+    case OP_ADD_STR     :
+    case OP_ADD_INT     : return OP_ADD;
+    case OP_SUBTRACT_NUM:
+    case OP_SUBTRACT_INT: return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM:
+    case OP_MULTIPLY_INT: return OP_MULTIPLY;
+    case OP_DIVIDE_NUM  :
+    case OP_DIVIDE_INT  : return OP_DIVIDE;
+    case OP_GREATER_NUM :
+    case OP_GREATER_INT : return OP_GREATER;
+    case OP_LESS_NUM    :
+    case OP_LESS_INT    : return OP_LESS;
+    default             : return (OpCode)instruction;
+    }
+}
+
+static SimdOp simd_op(OpCode op) {
+    switch (op) {
+    case OP_ADD     : return SIMD_ADD;
+    case OP_SUBTRACT: return SIMD_SUBTRACT;
+    case OP_MULTIPLY: return SIMD_MULTIPLY;
+    case OP_DIVIDE  : return SIMD_DIVIDE;
+    case OP_GREATER : return SIMD_GREATER;
+    default         : return SIMD_LESS;
+    }
+}
+
+// Whether every instruction in chunk has a vector form and refers to a
+// slot that existed when the batch started, with the stack never deeper
+// than BATCH_DEPTH_MAX. Arrays are left to the interpreter.
+static bool vectorizable(Chunk *chunk, size_t slots) {
+    size_t depth = 0;
+    for (size_t offset = 0; offset < chunk->count;) {
+        size_t pops = 0, pushes = 0, length = 1;
+        switch (generic_op(chunk->code[offset])) {
+        case OP_CONSTANT: pushes = 1; length = 2; break;
+        case OP_NIL     :
+        case OP_TRUE    :
+        case OP_FALSE   : pushes = 1; break;
+        case OP_NOT     :
+        case OP_NEGATE  : pops = pushes = 1; break;
+        case OP_EQUAL   :
+        case OP_GREATER :
+        case OP_LESS    :
+        case OP_ADD     :
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE  : pops = 2; pushes = 1; break;
+        case OP_GET_GLOBAL   : pushes = 1; length = 3; break;
+        case OP_SET_GLOBAL   :
+        case OP_DEFINE_GLOBAL: pops = pushes = 1; length = 3; break;
+        case OP_POP          : pops = 1; break;
+        case OP_CALL_NATIVE:
+            if (offset + 2 > chunk->count ||
+                chunk->code[offset + 1] >= vm.natives.count) {
+                return false;
+            }
+            pops = vm.natives.items[chunk->code[offset + 1]].arity;
+            pushes = 1;
+            length = 2;
+            break;
+        case OP_RETURN: return depth >= 1;
+        default              : return false;
+        }
+        if (length == 3 && (offset + 3 > chunk->count ||
+                            read_slot_operand(&chunk->code[offset + 1]) >=
+                                slots)) {
+            return false;
+        }
+        if (depth < pops || depth - pops + pushes > BATCH_DEPTH_MAX) {
+            return false;
+        }
+        depth = depth - pops + pushes;
+        offset += length;
+    }
+    return false;
+}
+
+static Lanes *ensure_lanes(Lanes *lanes) {
+    if (lanes->numbers == NULL) {
+        lanes->numbers =
+            aligned_alloc(SIMD_ALIGNMENT, BATCH_ROWS * sizeof(double));
+        if (lanes->numbers == NULL) exit(1);
+        // Kernels run over the padding of the last block, which should
+        // hold numbers even before anything was written there
+        memset(lanes->numbers, 0, BATCH_ROWS * sizeof(double));
+        lanes->values = ALLOCATE(Value, BATCH_ROWS);
+    }
+    return lanes;
+}
+
+static void free_lanes(Lanes *lanes) {
+    // Aligned buffers come from aligned_alloc(), not reallocate()
+    free(lanes->numbers);
+    FREE_ARRAY(Value, lanes->values, BATCH_ROWS);
+}
+
+static Vector constant_vector(Value value) {
+    return (Vector){VECTOR_CONSTANT, value, NULL, NULL};
+}
+
+static Vector numbers_vector(VectorKind kind, const double *numbers) {
+    return (Vector){kind, NIL_VAL, numbers, NULL};
+}
+
+static Vector values_vector(const Value *values) {
+    return (Vector){VECTOR_VALUE, NIL_VAL, NULL, values};
+}
+
+static Value row_value(const Vector *vector, size_t row) {
+    switch (vector->kind) {
+    case VECTOR_NUMBER: return NUMBER_VAL(vector->numbers[row]);
+    case VECTOR_BOOL  : return BOOL_VAL(vector->numbers[row] != 0.0);
+    case VECTOR_VALUE : return vector->values[row];
+    default           : return vector->constant;
+    }
+}
+
+static Value column_value(const Column *column, size_t row) {
+    switch (column->type) {
+    case COLUMN_NUMBER: return NUMBER_VAL(column->as.numbers[row]);
+    case COLUMN_BOOL  : return BOOL_VAL(column->as.bools[row]);
+    default:
+        if (column->as.strings[row] == NULL) return NIL_VAL;
+        return OBJ_VAL((Obj *)column->as.strings[row]);
+    }
+}
+
+// For when an operand that is the same for every row has the wrong type
+static void fail_rows(Batch *batch) {
+    memset(batch->failed, true, batch->rows * sizeof(bool));
+}
+
+// A binary instruction on one row, as run() would do it. Returns false
+// where run() would stop with an error, and for arrays, which are left to
+// run() itself.
+static bool binary_value(OpCode op, Value a, Value b, Value *result) {
+    if (op == OP_EQUAL) {
+        *result = BOOL_VAL(values_equal(a, b));
+        return true;
+    }
+    if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+        *result = number_binary(op, a, b);
+        return true;
+    }
+    if (op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+        *result = OBJ_VAL((Obj *)concat_str(AS_STRING(a), AS_STRING(b)));
+        return true;
+    }
+    return false;
+}
+
+static bool unary_value(OpCode op, Value a, Value *result) {
+    if (IS_ARRAY(a)) return false;
+    if (op == OP_NOT) {
+        *result = BOOL_VAL(is_falsey(a));
+        return true;
+    }
+    if (!IS_NUMERIC(a)) return false;
+    *result = number_negate(a);
+    return true;
+}
+
+// Points *items at vector's rows if they are doubles of the given kind,
+// spreading a constant over block, whose one padded block of SIMD_LANES is
+// all a scalar operand needs
+static bool lane_doubles(const Vector *vector, VectorKind kind, double *block,
+                         const double **items, bool *scalar) {
+    if (vector->kind == kind) {
+        *items = vector->numbers;
+        *scalar = false;
+        return true;
+    }
+    if (vector->kind != VECTOR_CONSTANT) return false;
+
+    Value value = vector->constant;
+    double number;
+    if (kind == VECTOR_NUMBER && IS_NUMERIC(value)) {
+        number = as_double(value);
+    } else if (kind == VECTOR_BOOL && IS_BOOL(value)) {
+        number = AS_BOOL(value) ? 1.0 : 0.0;
+    } else {
+        return false;
+    }
+    for (size_t i = 0; i < SIMD_LANES; i++) block[i] = number;
+    *items = block;
+    *scalar = true;
+    return true;
+}
+
+static void equal_lanes(double *out, const double *a, bool a_scalar,
+                        const double *b, bool b_scalar, size_t padded) {
+    size_t a_step = !a_scalar, b_step = !b_scalar;
+    for (size_t i = 0; i < padded; i++) out[i] = a[i * a_step] == b[i * b_step];
+}
+
+// Replaces the two vectors from depth up with the result of op on them
+static void binary(Batch *batch, OpCode op, size_t depth) {
+    Vector *a = &batch->stack[depth], *b = &batch->stack[depth + 1];
+    if (a->kind == VECTOR_CONSTANT && b->kind == VECTOR_CONSTANT) {
+        Value result;
+        if (!binary_value(op, a->constant, b->constant, &result)) {
+            fail_rows(batch);
+            result = NIL_VAL;
+        }
+        *a = constant_vector(result);
+        return;
+    }
+
+    Lanes *out = ensure_lanes(&batch->lanes[depth]);
+    _Alignas(SIMD_ALIGNMENT) double a_block[SIMD_LANES];
+    _Alignas(SIMD_ALIGNMENT) double b_block[SIMD_LANES];
+    const double *x, *y;
+    bool x_scalar, y_scalar;
+    if (op == OP_EQUAL) {
+        // Only numbers against numbers and bools against bools, anything
+        // else is compared by type first
+        VectorKind kind = a->kind == VECTOR_BOOL || b->kind == VECTOR_BOOL
+                              ? VECTOR_BOOL
+                              : VECTOR_NUMBER;
+        if (lane_doubles(a, kind, a_block, &x, &x_scalar) &&
+            lane_doubles(b, kind, b_block, &y, &y_scalar)) {
+            equal_lanes(out->numbers, x, x_scalar, y, y_scalar, batch->padded);
+            *a = numbers_vector(VECTOR_BOOL, out->numbers);
+            return;
+        }
+    } else if (lane_doubles(a, VECTOR_NUMBER, a_block, &x, &x_scalar) &&
+               lane_doubles(b, VECTOR_NUMBER, b_block, &y, &y_scalar)) {
+        simd_binary(simd_op(op), out->numbers, x, x_scalar, y, y_scalar,
+                    batch->padded);
+        bool comparison = op == OP_GREATER || op == OP_LESS;
+        *a = numbers_vector(comparison ? VECTOR_BOOL : VECTOR_NUMBER,
+                            out->numbers);
+        return;
+    }
+
+    for (size_t row = 0; row < batch->rows; row++) {
+        if (batch->failed[row]) continue;
+        if (!binary_value(op, row_value(a, row), row_value(b, row),
+                          &out->values[row])) {
+            batch->failed[row] = true;
+        }
+    }
+    *a = values_vector(out->values);
+}
+
+static void unary(Batch *batch, OpCode op, size_t depth) {
+    Vector *a = &batch->stack[depth];
+    if (a->kind == VECTOR_CONSTANT) {
+        Value result;
+        if (!unary_value(op, a->constant, &result)) {
+            fail_rows(batch);
+            result = NIL_VAL;
+        }
+        *a = constant_vector(result);
+        return;
+    }
+    // Numbers are never falsey
+    if (op == OP_NOT && a->kind == VECTOR_NUMBER) {
+        *a = constant_vector(BOOL_VAL(false));
+        return;
+    }
+
+    Lanes *out = ensure_lanes(&batch->lanes[depth]);
+    if ((op == OP_NOT && a->kind == VECTOR_BOOL) ||
+        (op == OP_NEGATE && a->kind == VECTOR_NUMBER)) {
+        simd_unary(op == OP_NOT ? SIMD_NOT : SIMD_NEGATE, out->numbers,
+                   a->numbers, batch->padded);
+        a->numbers = out->numbers;
+        return;
+    }
+
+    for (size_t row = 0; row < batch->rows; row++) {
+        if (batch->failed[row]) continue;
+        if (!unary_value(op, row_value(a, row), &out->values[row])) {
+            batch->failed[row] = true;
+        }
+    }
+    *a = values_vector(out->values);
+}
+
+// Calls native once per row on the vectors from depth up. Results that are
+// all doubles are kept as a number vector too, so the instructions after
+// it can still use the kernels.
+static void call_native(Batch *batch, const Native *native, size_t depth) {
+    Lanes *out = ensure_lanes(&batch->lanes[depth]);
+    const Vector *args = &batch->stack[depth];
+    Value values[UINT8_MAX];
+    bool numbers = true;
+    for (size_t row = 0; row < batch->rows; row++) {
+        if (batch->failed[row]) continue;
+        for (u8 i = 0; i < native->arity; i++) {
+            values[i] = row_value(&args[i], row);
+        }
+        Value *result = &out->values[row];
+        if (native->function(values, result) != NULL) {
+            batch->failed[row] = true;
+        } else if (IS_NUMBER(*result)) {
+            out->numbers[row] = AS_NUMBER(*result);
+        } else {
+            numbers = false;
+        }
+    }
+    batch->stack[depth] = numbers ? numbers_vector(VECTOR_NUMBER, out->numbers)
+                                  : values_vector(out->values);
+}
+
+// Copies vector's rows into lanes, so that writing to either one later
+// leaves the other alone
+static Vector copy_vector(Batch *batch, const Vector *vector, Lanes *lanes) {
+    switch (vector->kind) {
+    case VECTOR_NUMBER:
+    case VECTOR_BOOL:
+        ensure_lanes(lanes);
+        memcpy(lanes->numbers, vector->numbers,
+               batch->padded * sizeof(double));
+        return numbers_vector(vector->kind, lanes->numbers);
+    case VECTOR_VALUE:
+        ensure_lanes(lanes);
+        memcpy(lanes->values, vector->values, batch->rows * sizeof(Value));
+        return values_vector(lanes->values);
+    default: return *vector;
+    }
+}
+
+static Vector load_column(Batch *batch, const Column *column, Lanes *lanes) {
+    size_t first = batch->first;
+    ensure_lanes(lanes);
+    switch (column->type) {
+    case COLUMN_NUMBER:
+        // Copied rather than pointed to, since the kernels need their
+        // operands aligned
+        memcpy(lanes->numbers, column->as.numbers + first,
+               batch->rows * sizeof(double));
+        return numbers_vector(VECTOR_NUMBER, lanes->numbers);
+    case COLUMN_BOOL:
+        for (size_t row = 0; row < batch->rows; row++) {
+            lanes->numbers[row] = column->as.bools[first + row];
+        }
+        return numbers_vector(VECTOR_BOOL, lanes->numbers);
+    default:
+        for (size_t row = 0; row < batch->rows; row++) {
+            lanes->values[row] = column_value(column, first + row);
+        }
+        return values_vector(lanes->values);
+    }
+}
+
+static void get_global(Batch *batch, size_t depth, u16 slot) {
+    Vector *vector = &batch->stack[depth];
+    Binding *binding = &batch->bindings[slot];
+    if (binding->assigned) {
+        *vector = copy_vector(batch, &binding->vector, &batch->lanes[depth]);
+    } else if (batch->bound[slot] != NULL) {
+        *vector = load_column(batch, batch->bound[slot], &batch->lanes[depth]);
+    } else if (IS_UNDEFINED(vm.globals.values[slot])) {
+        fail_rows(batch);
+        *vector = constant_vector(NIL_VAL);
+    } else {
+        *vector = constant_vector(vm.globals.values[slot]);
+    }
+}
+
+static void set_global(Batch *batch, size_t depth, u16 slot, bool define) {
+    Binding *binding = &batch->bindings[slot];
+    if (!define && !binding->assigned && batch->bound[slot] == NULL &&
+        IS_UNDEFINED(vm.globals.values[slot])) {
+        fail_rows(batch);
+    }
+    binding->vector = copy_vector(batch, &batch->stack[depth], &binding->lanes);
+    binding->assigned = true;
+}
+
+// Runs every instruction of the chunk over the current block, storing the
+// result of each row that doesn't fail in results
+static void run_block(Batch *batch, Value *results) {
+    Chunk *chunk = batch->chunk;
+    u8 *ip = chunk->code;
+    size_t depth = 0;
+    for (size_t slot = 0; slot < batch->slots; slot++) {
+        batch->bindings[slot].assigned = false;
+    }
+
+    while (true) {
+        OpCode op = generic_op(*ip++);
+        switch (op) {
+        case OP_CONSTANT:
+            batch->stack[depth++] =
+                constant_vector(chunk->constants.items[*ip++]);
+            break;
+        case OP_NIL  : batch->stack[depth++] = constant_vector(NIL_VAL); break;
+        case OP_TRUE:
+            batch->stack[depth++] = constant_vector(BOOL_VAL(true));
+            break;
+        case OP_FALSE:
+            batch->stack[depth++] = constant_vector(BOOL_VAL(false));
+            break;
+        case OP_NOT:
+        case OP_NEGATE: unary(batch, op, depth - 1); break;
+        case OP_GET_GLOBAL:
+            get_global(batch, depth++, read_slot_operand(ip));
+            ip += 2;
+            break;
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+            set_global(batch, depth - 1, read_slot_operand(ip),
+                       op == OP_DEFINE_GLOBAL);
+            ip += 2;
+            break;
+        case OP_POP: depth--; break;
+        case OP_CALL_NATIVE: {
+            const Native *native = &vm.natives.items[*ip++];
+            depth -= native->arity;
+            call_native(batch, native, depth++);
+            break;
+        }
+        case OP_RETURN: {
+            const Vector *result = &batch->stack[depth - 1];
+            for (size_t row = 0; row < batch->rows; row++) {
+                if (!batch->failed[row]) {
+                    results[batch->first + row] = row_value(result, row);
+                }
+            }
+            return;
+        }
+        default:
+            binary(batch, op, depth - 2);
+            depth--;
+            break;
+        }
+    }
+}
+
+static void restore_globals(Batch *batch, const Value *saved) {
+    if (batch->slots > 0) {
+        memcpy(vm.globals.values, saved, batch->slots * sizeof(Value));
+    }
+}
+
+// Runs row on its own through the interpreter, from the globals as they
+// were when the batch started plus the row's columns
+static bool run_row(Batch *batch, size_t row, const Value *saved,
+                    Value *result) {
+    restore_globals(batch, saved);
+    for (size_t i = 0; i < batch->column_count; i++) {
+        const Column *column = &batch->columns[i];
+        vm.globals.values[column->slot] = column_value(column, row);
+    }
+    vm.stats.batch_fallbacks++;
+    if (run_chunk(batch->chunk) != INTERPRET_OK) return false;
+    *result = vm.result;
+    return true;
+}
+
+size_t run_batch(Chunk *chunk, const Column *columns, size_t column_count,
+                 size_t rows, Value *results, bool *failed) {
+    Batch *batch = ALLOCATE(Batch, 1);
+    batch->chunk = chunk;
+    batch->columns = columns;
+    batch->column_count = column_count;
+    for (size_t depth = 0; depth < BATCH_DEPTH_MAX; depth++) {
+        batch->lanes[depth] = (Lanes){NULL, NULL};
+    }
+    batch->slots = vm.globals.count;
+    batch->bound = ALLOCATE(const Column *, batch->slots);
+    batch->bindings = ALLOCATE(Binding, batch->slots);
+    for (size_t slot = 0; slot < batch->slots; slot++) {
+        batch->bound[slot] = NULL;
+        batch->bindings[slot].lanes = (Lanes){NULL, NULL};
+    }
+    for (size_t i = 0; i < column_count; i++) {
+        batch->bound[columns[i].slot] = &columns[i];
+    }
+    Value *saved = ALLOCATE(Value, batch->slots);
+    if (batch->slots > 0) {
+        memcpy(saved, vm.globals.values, batch->slots * sizeof(Value));
+    }
+
+    bool vectors = vectorizable(chunk, batch->slots);
+    size_t failures = 0;
+    for (size_t first = 0; first < rows; first += BATCH_ROWS) {
+        batch->first = first;
+        batch->rows = rows - first < BATCH_ROWS ? rows - first : BATCH_ROWS;
+        batch->padded =
+            (batch->rows + SIMD_LANES - 1) / SIMD_LANES * SIMD_LANES;
+        memset(batch->failed, !vectors, batch->rows * sizeof(bool));
+        if (vectors) run_block(batch, results);
+
+        for (size_t row = 0; row < batch->rows; row++) {
+            bool ok = true;
+            if (batch->failed[row]) {
+                ok = run_row(batch, first + row, saved, &results[first + row]);
+            } else {
+                vm.stats.batch_rows++;
+            }
+            if (!ok) {
+                results[first + row] = NIL_VAL;
+                failures++;
+            }
+            if (failed != NULL) failed[first + row] = !ok;
+        }
+    }
+    restore_globals(batch, saved);
+
+    for (size_t depth = 0; depth < BATCH_DEPTH_MAX; depth++) {
+        free_lanes(&batch->lanes[depth]);
+    }
+    for (size_t slot = 0; slot < batch->slots; slot++) {
+        free_lanes(&batch->bindings[slot].lanes);
+    }
+    FREE_ARRAY(Value, saved, batch->slots);
+    FREE_ARRAY(Binding, batch->bindings, batch->slots);
+    FREE_ARRAY(const Column *, batch->bound, batch->slots);
+    FREE(Batch, batch);
+    return failures;
+}
+
+static char *read_input(int fd, size_t *alloc) {
+    char *buffer = NULL;
+    size_t count = 0;
+    *alloc = 0;
+    while (true) {
+        if (*alloc < count + READ_SIZE + 1) {
+            size_t old_alloc = *alloc;
+            *alloc = GROW_CAPACITY(old_alloc);
+            while (*alloc < count + READ_SIZE + 1) {
+                *alloc = GROW_CAPACITY(*alloc);
+            }
+            buffer = GROW_ARRAY(char, buffer, old_alloc, *alloc);
+        }
+
+        ssize_t bytes_read;
+        do {
+            bytes_read = read(fd, buffer + count, READ_SIZE);
+        } while (bytes_read < 0 && errno == EINTR);
+        if (bytes_read <= 0) break;
+        count += bytes_read;
+    }
+    buffer[count] = '\0';
+    return buffer;
+}
+
+static void write_field(FieldArray *array, char *field) {
+    if (array->alloc < array->count + 1) {
+        size_t old_alloc = array->alloc;
+        array->alloc = GROW_CAPACITY(old_alloc);
+        array->items =
+            GROW_ARRAY(char *, array->items, old_alloc, array->alloc);
+    }
+    array->items[array->count++] = field;
+}
+
+// Cuts the line starting at *next off at its newline, and splits it into
+// fields at its commas. Quoting isn't supported. Returns how many fields
+// the line had, 0 for an empty one.
+static size_t split_line(char **next, FieldArray *fields) {
+    char *line = *next;
+    char *end = strchr(line, '\n');
+    *next = end == NULL ? line + strlen(line) : end + 1;
+    if (end == NULL) end = line + strlen(line);
+    if (end > line && end[-1] == '\r') end--;
+    *end = '\0';
+    if (*line == '\0') return 0;
+
+    size_t count = 1;
+    write_field(fields, line);
+    for (char *comma; (comma = strchr(line, ',')) != NULL; count++) {
+        *comma = '\0';
+        line = comma + 1;
+        write_field(fields, line);
+    }
+    return count;
+}
+
+static bool parse_number(const char *field, double *number) {
+    char *end;
+    *number = strtod(field, &end);
+    return end != field && *end == '\0';
+}
+
+static bool parse_bool(const char *field, bool *boolean) {
+    *boolean = strcmp(field, "true") == 0;
+    return *boolean || strcmp(field, "false") == 0;
+}
+
+// Types column i of the fields by what all its fields parse as, and
+// converts them
+static void build_column(Column *column, FieldArray *fields, size_t i,
+                          size_t width, size_t rows) {
+    double number;
+    bool boolean, numbers = true, bools = true;
+    for (size_t row = 0; row < rows; row++) {
+        const char *field = fields->items[(row + 1) * width + i];
+        numbers = numbers && parse_number(field, &number);
+        bools = bools && parse_bool(field, &boolean);
+    }
+
+    if (numbers && rows > 0) {
+        double *items = ALLOCATE(double, rows);
+        for (size_t row = 0; row < rows; row++) {
+            parse_number(fields->items[(row + 1) * width + i], &items[row]);
+        }
+        column->type = COLUMN_NUMBER;
+        column->as.numbers = items;
+        return;
+    }
+    if (bools && rows > 0) {
+        bool *items = ALLOCATE(bool, rows);
+        for (size_t row = 0; row < rows; row++) {
+            parse_bool(fields->items[(row + 1) * width + i], &items[row]);
+        }
+        column->type = COLUMN_BOOL;
+        column->as.bools = items;
+        return;
+    }
+    ObjString **items = ALLOCATE(ObjString *, rows);
+    for (size_t row = 0; row < rows; row++) {
+        const char *field = fields->items[(row + 1) * width + i];
+        items[row] = copy_str(field, strlen(field));
+    }
+    column->type = COLUMN_STRING;
+    column->as.strings = items;
+}
+
+static void free_column(Column *column) {
+    switch (column->type) {
+    case COLUMN_NUMBER: FREE(double, (double *)column->as.numbers); break;
+    case COLUMN_BOOL  : FREE(bool, (bool *)column->as.bools); break;
+    case COLUMN_STRING:
+        FREE(ObjString *, (ObjString **)column->as.strings);
+        break;
+    }
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int eval_batch(const char *expression, const char *path) {
+    int fd = STDIN_FILENO;
+    if (path != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Could not open file \"%s\".\n", path);
+            return 74;
+        }
+    }
+    size_t input_alloc;
+    char *input = read_input(fd, &input_alloc);
+    if (fd != STDIN_FILENO) close(fd);
+
+    // Every line's fields go into one array, the header's first, so field
+    // j of row i is at (i + 1) * width + j
+    FieldArray fields = {0, 0, NULL};
+    char *next = input;
+    size_t width = 0, line = 1;
+    while (*next != '\0' && (width = split_line(&next, &fields)) == 0) line++;
+    size_t rows = 0;
+    int status = 0;
+    while (*next != '\0') {
+        line++;
+        size_t count = split_line(&next, &fields);
+        if (count == 0) continue;
+        if (count != width) {
+            fprintf(stderr, "Line %zu has %zu fields, expected %zu.\n", line,
+                    count, width);
+            status = 65;
+            break;
+        }
+        rows++;
+    }
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (status == 0 && !compile(expression, &chunk)) status = 65;
+
+    Column *columns = ALLOCATE(Column, width);
+    size_t built = 0;
+    for (; status == 0 && built < width; built++) {
+        const char *name = fields.items[built];
+        i32 slot = global_slot(&vm.globals, copy_str(name, strlen(name)));
+        if (slot < 0) {
+            fprintf(stderr, "Too many global variables.\n");
+            status = 65;
+            break;
+        }
+        columns[built].slot = (u16)slot;
+        build_column(&columns[built], &fields, built, width, rows);
+    }
+
+    if (status == 0) {
+        Value *results = ALLOCATE(Value, rows);
+        bool *failed = ALLOCATE(bool, rows);
+        double start = now();
+        size_t errors = run_batch(&chunk, columns, width, rows, results,
+                                  failed);
+        double seconds = now() - start;
+
+        for (size_t row = 0; row < rows; row++) {
+            if (failed[row]) write_cstr(&vm.out, "error");
+            else print_Value(results[row]);
+            write_char(&vm.out, '\n');
+        }
+        flush_writer(&vm.out);
+        fprintf(stderr, "batch: %zu rows (%zu errors) in %.3fs, %.0f rows/s\n",
+                rows, errors, seconds, seconds > 0 ? rows / seconds : 0);
+
+        FREE_ARRAY(Value, results, rows);
+        FREE_ARRAY(bool, failed, rows);
+    }
+
+    for (size_t i = 0; i < built; i++) free_column(&columns[i]);
+    FREE_ARRAY(Column, columns, width);
+    free_chunk(&chunk);
+    FREE_ARRAY(char *, fields.items, fields.alloc);
+    FREE_ARRAY(char, input, input_alloc);
+    return status;
+}
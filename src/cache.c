@@ -0,0 +1,193 @@
+#include "cache.h"
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+
+#define CACHE_MAX_LOAD 0.75
+
+// Marks a slot whose entry was evicted, so that probing continues past it
+static CacheEntry tombstone;
+
+void init_cache(ChunkCache *cache, size_t budget) {
+    cache->count = 0;
+    cache->alloc = 0;
+    cache->entries = NULL;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->bytes = 0;
+    cache->budget = budget;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+}
+
+static void free_entry(CacheEntry *entry) {
+    free_chunk(&entry->chunk);
+    FREE_ARRAY(char, entry->source, entry->length + 1);
+    FREE(CacheEntry, entry);
+}
+
+void free_cache(ChunkCache *cache) {
+    CacheEntry *entry = cache->newest;
+    while (entry != NULL) {
+        CacheEntry *older = entry->older;
+        free_entry(entry);
+        entry = older;
+    }
+    FREE_ARRAY(CacheEntry *, cache->entries, cache->alloc);
+    init_cache(cache, cache->budget);
+}
+
+size_t chunk_bytes(Chunk *chunk) {
+    if (chunk->block != NULL) return chunk->block_size;
+    return chunk->alloc * sizeof(u8) + chunk->lines.alloc * sizeof(size_t) +
+           chunk->constants.alloc * sizeof(Value);
+}
+
+static CacheEntry **find_slot(CacheEntry **entries, size_t alloc,
+                              const char *source, size_t length, u32 hash) {
+    size_t index = hash % alloc;
+    CacheEntry **first_tombstone = NULL;
+
+    while (true) {
+        CacheEntry **slot = &entries[index];
+        CacheEntry *entry = *slot;
+        if (entry == NULL) {
+            return first_tombstone != NULL ? first_tombstone : slot;
+        } else if (entry == &tombstone) {
+            if (first_tombstone == NULL) first_tombstone = slot;
+        } else if (entry->hash == hash && entry->length == length &&
+                   memcmp(entry->source, source, length) == 0) {
+            return slot;
+        }
+        index = (index + 1) % alloc;
+    }
+}
+
+static void resize_cache(ChunkCache *cache, size_t new_alloc) {
+    CacheEntry **entries = ALLOCATE(CacheEntry *, new_alloc);
+    for (size_t i = 0; i < new_alloc; i++) entries[i] = NULL;
+
+    // Tombstones aren't carried over, so count goes back to only
+    // including live entries
+    cache->count = 0;
+    for (CacheEntry *entry = cache->newest; entry != NULL;
+         entry = entry->older) {
+        CacheEntry **slot = find_slot(entries, new_alloc, entry->source,
+                                      entry->length, entry->hash);
+        *slot = entry;
+        cache->count++;
+    }
+
+    FREE_ARRAY(CacheEntry *, cache->entries, cache->alloc);
+    cache->entries = entries;
+    cache->alloc = new_alloc;
+}
+
+static void unlink_entry(ChunkCache *cache, CacheEntry *entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+}
+
+static void link_newest(ChunkCache *cache, CacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) cache->newest->newer = entry;
+    cache->newest = entry;
+    if (cache->oldest == NULL) cache->oldest = entry;
+}
+
+static void evict_oldest(ChunkCache *cache) {
+    CacheEntry *entry = cache->oldest;
+    CacheEntry **slot = find_slot(cache->entries, cache->alloc, entry->source,
+                                  entry->length, entry->hash);
+    *slot = &tombstone;
+
+    unlink_entry(cache, entry);
+    cache->bytes -= entry->bytes;
+    cache->evictions++;
+    free_entry(entry);
+}
+
+void set_cache_budget(ChunkCache *cache, size_t budget) {
+    cache->budget = budget;
+    while (cache->bytes > cache->budget) evict_oldest(cache);
+}
+
+Chunk *cache_lookup(ChunkCache *cache, const char *source, size_t length,
+                    u32 hash) {
+    if (cache->count == 0) {
+        cache->misses++;
+        return NULL;
+    }
+
+    CacheEntry *entry =
+        *find_slot(cache->entries, cache->alloc, source, length, hash);
+    if (entry == NULL || entry == &tombstone) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    if (entry != cache->newest) {
+        unlink_entry(cache, entry);
+        link_newest(cache, entry);
+    }
+    return &entry->chunk;
+}
+
+// Freezes a copy of chunk into the cache, returning where it now lives.
+// chunk itself stays with the caller, who can free it or compile into it
+// again. If the copy doesn't fit in the budget at all NULL is returned.
+Chunk *cache_insert(ChunkCache *cache, const char *source, size_t length,
+                    u32 hash, const Chunk *chunk) {
+    Chunk frozen;
+    freeze_chunk(&frozen, chunk);
+    size_t bytes = sizeof(CacheEntry) + length + 1 + chunk_bytes(&frozen);
+    if (bytes > cache->budget) {
+        free_chunk(&frozen);
+        return NULL;
+    }
+
+    while (cache->bytes + bytes > cache->budget) evict_oldest(cache);
+
+    if (cache->count + 1 > cache->alloc * CACHE_MAX_LOAD) {
+        resize_cache(cache, GROW_CAPACITY(cache->alloc));
+    }
+
+    CacheEntry *entry = ALLOCATE(CacheEntry, 1);
+    entry->hash = hash;
+    entry->length = length;
+    entry->source = ALLOCATE(char, length + 1);
+    memcpy(entry->source, source, length);
+    entry->source[length] = '\0';
+    entry->chunk = frozen;
+    entry->bytes = bytes;
+
+    CacheEntry **slot =
+        find_slot(cache->entries, cache->alloc, source, length, hash);
+    // Reusing a tombstone doesn't change how full the table is
+    if (*slot == NULL) cache->count++;
+    *slot = entry;
+
+    link_newest(cache, entry);
+    cache->bytes += bytes;
+    return &entry->chunk;
+}
+
+void print_cache_stats(ChunkCache *cache, FILE *file) {
+    size_t entries = 0;
+    for (CacheEntry *entry = cache->newest; entry != NULL;
+         entry = entry->older) {
+        entries++;
+    }
+
+    fprintf(file,
+            "chunk cache: %llu hits, %llu misses, %llu evictions, "
+            "%zu entries, %zu/%zu bytes\n",
+            (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+            (unsigned long long)cache->evictions, entries, cache->bytes,
+            cache->budget);
+}
@@ -1,5 +1,7 @@
 #include "chunk.h"
+#include "jit.h"
 #include "memory.h"
+#include "register.h"
 #include "value.h"
 
 void init_LineArray(LineArray *array) {
@@ -12,6 +14,11 @@ void init_chunk(Chunk *chunk) {
     chunk->count = 0;
     chunk->alloc = 0;
     chunk->code = NULL;
+    chunk->registers = NULL;
+    chunk->runs = 0;
+    chunk->jit = NULL;
+    chunk->block = NULL;
+    chunk->block_size = 0;
     init_LineArray(&chunk->lines);
     init_ValueArray(&chunk->constants);
 }
@@ -22,13 +29,39 @@ void free_LineArray(LineArray *array) {
 }
 
 void free_chunk(Chunk *chunk) {
-    FREE_ARRAY(u8, chunk->code, chunk->alloc);
-    FREE_ARRAY(size_t, &chunk->lines, chunk->alloc);
-    free_LineArray(&chunk->lines);
-    free_ValueArray(&chunk->constants);
+    if (chunk->block != NULL) {
+        free(chunk->block);
+    } else {
+        FREE_ARRAY(u8, chunk->code, chunk->alloc);
+        free_LineArray(&chunk->lines);
+        free_ValueArray(&chunk->constants);
+    }
+    free_reg_chunk(chunk->registers);
+    free_jit(chunk->jit);
     init_chunk(chunk);
 }
 
+// Empties the chunk while keeping its buffers around for the next
+// compilation
+void reset_chunk(Chunk *chunk) {
+    // A frozen chunk's buffers can't grow, so there is nothing to keep
+    if (chunk->block != NULL) {
+        free_chunk(chunk);
+        return;
+    }
+    chunk->count = 0;
+    if (chunk->lines.items != NULL) {
+        memset(chunk->lines.items, 0, chunk->lines.alloc * sizeof(size_t));
+    }
+    chunk->lines.count = 0;
+    chunk->constants.count = 0;
+    free_reg_chunk(chunk->registers);
+    chunk->registers = NULL;
+    free_jit(chunk->jit);
+    chunk->jit = NULL;
+    chunk->runs = 0;
+}
+
 void write_line(LineArray *array, size_t line) {
     // The condition for growing the array is different, we check
     // whether the current size fits the line we want to write,
@@ -45,6 +78,7 @@ void write_line(LineArray *array, size_t line) {
                (array->alloc - old_alloc) * sizeof(size_t));
     }
     array->items[line]++;
+    if (line >= array->count) array->count = line + 1;
 }
 
 void write_chunk(Chunk *chunk, u8 byte, size_t line) {
@@ -64,3 +98,45 @@ size_t add_constant(Chunk *chunk, Value value) {
     write_ValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
 }
+
+static size_t align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Copies a finished chunk into frozen, packing its code, constants and line
+// counts into a single exact-size allocation so that run() touches as few
+// cache lines as possible. chunk is left untouched, which lets the compiler
+// reuse its buffers. The layout of frozen is fixed from here on: it must not
+// be written to or have constants added, although quickening still rewrites
+// its instructions in place.
+void freeze_chunk(Chunk *frozen, const Chunk *chunk) {
+    size_t code_size = chunk->count * sizeof(u8);
+    size_t constants_offset = align_up(code_size, _Alignof(Value));
+    size_t constants_size = chunk->constants.count * sizeof(Value);
+    size_t lines_offset = constants_offset + constants_size;
+    size_t lines_size = chunk->lines.count * sizeof(size_t);
+    size_t size = align_up(lines_offset + lines_size, CHUNK_ALIGNMENT);
+    if (size == 0) size = CHUNK_ALIGNMENT;
+
+    u8 *block = aligned_alloc(CHUNK_ALIGNMENT, size);
+    if (block == NULL) exit(1);
+    if (code_size > 0) memcpy(block, chunk->code, code_size);
+    if (constants_size > 0) {
+        memcpy(block + constants_offset, chunk->constants.items,
+               constants_size);
+    }
+    if (lines_size > 0) {
+        memcpy(block + lines_offset, chunk->lines.items, lines_size);
+    }
+
+    init_chunk(frozen);
+    frozen->block = block;
+    frozen->block_size = size;
+    frozen->count = frozen->alloc = chunk->count;
+    frozen->code = block;
+    frozen->constants.count = frozen->constants.alloc =
+        chunk->constants.count;
+    frozen->constants.items = (Value *)(block + constants_offset);
+    frozen->lines.count = frozen->lines.alloc = chunk->lines.count;
+    frozen->lines.items = (size_t *)(block + lines_offset);
+}
@@ -0,0 +1,161 @@
+#include "clox.h"
+#include "batch.h"
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "heap.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "recorder.h"
+#include "snapshot.h"
+#include "stack.h"
+#include "globals.h"
+#include "vm.h"
+
+extern VM vm;
+
+struct CloxProgram {
+    Chunk chunk;
+};
+
+void clox_init(void) {
+    init_VM();
+    install_stack_guard();
+}
+
+void clox_free(void) { free_VM(); }
+
+CloxProgram *clox_prepare(const char *source) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (!compile(source, &chunk)) {
+        free_chunk(&chunk);
+        return NULL;
+    }
+
+    CloxProgram *program = ALLOCATE(CloxProgram, 1);
+    freeze_chunk(&program->chunk, &chunk);
+    free_chunk(&chunk);
+    return program;
+}
+
+void clox_release(CloxProgram *program) {
+    free_chunk(&program->chunk);
+    FREE(CloxProgram, program);
+}
+
+InterpretResult clox_execute(CloxProgram *program, Value *result) {
+    InterpretResult status = run_chunk(&program->chunk);
+    if (status == INTERPRET_OK && result != NULL) *result = vm.result;
+    return status;
+}
+
+size_t clox_execute_batch(CloxProgram *program, const CloxColumn *columns,
+                          size_t column_count, size_t rows, Value *results,
+                          bool *failed) {
+    // Columns that get no slot are left out, and reading them fails the
+    // way any undefined global does
+    Column *bound = ALLOCATE(Column, column_count);
+    size_t count = 0;
+    for (size_t i = 0; i < column_count; i++) {
+        const CloxColumn *column = &columns[i];
+        i32 slot = global_slot(&vm.globals,
+                               copy_str(column->name, strlen(column->name)));
+        if (slot < 0) continue;
+
+        Column *into = &bound[count++];
+        into->slot = (u16)slot;
+        into->type = column->type;
+        if (column->type == COLUMN_NUMBER) {
+            into->as.numbers = column->items;
+        } else if (column->type == COLUMN_BOOL) {
+            into->as.bools = column->items;
+        } else {
+            // Interned up front, so that every row reads an ObjString
+            const char *const *chars = column->items;
+            ObjString **strings = ALLOCATE(ObjString *, rows);
+            for (size_t row = 0; row < rows; row++) {
+                strings[row] = chars[row] == NULL
+                                   ? NULL
+                                   : copy_str(chars[row], strlen(chars[row]));
+            }
+            into->as.strings = strings;
+        }
+    }
+
+    size_t failures =
+        run_batch(&program->chunk, bound, count, rows, results, failed);
+
+    for (size_t i = 0; i < count; i++) {
+        if (bound[i].type == COLUMN_STRING) {
+            FREE_ARRAY(ObjString *, (ObjString **)bound[i].as.strings, rows);
+        }
+    }
+    FREE_ARRAY(Column, bound, column_count);
+    return failures;
+}
+
+void clox_pin_source(const char *source, size_t length) {
+    pin_source(source, length, false);
+}
+
+void clox_set_global(const char *name, Value value) {
+    i32 slot = global_slot(&vm.globals, copy_str(name, strlen(name)));
+    if (slot >= 0) vm.globals.values[slot] = value;
+}
+
+bool clox_get_global(const char *name, Value *value) {
+    u32 slot;
+    if (!find_global(&vm.globals, copy_str(name, strlen(name)), &slot) ||
+        IS_UNDEFINED(vm.globals.values[slot])) {
+        return false;
+    }
+    *value = vm.globals.values[slot];
+    return true;
+}
+
+bool clox_register_native(const char *name, int arity, NativeFn function) {
+    if (arity < 0 || arity > UINT8_MAX) return false;
+    return define_native(&vm.natives, name, (u8)arity, function);
+}
+
+bool clox_snapshot_save(const char *path) { return write_snapshot(path); }
+
+bool clox_snapshot_load(const char *path) { return load_snapshot(path); }
+
+void clox_heap_dump(FILE *file) { dump_heap(file); }
+
+void clox_flight_recorder(int fd) { vm.recorder.fd = fd; }
+
+void clox_flight_recorder_dump(int fd) {
+    dump_recorder(&vm.recorder, fd, "requested");
+}
+
+Value clox_nil(void) { return NIL_VAL; }
+
+Value clox_bool(bool boolean) { return BOOL_VAL(boolean); }
+
+Value clox_number(double number) { return NUMBER_VAL(number); }
+
+Value clox_integer(int64_t integer) { return INT_VAL(integer); }
+
+Value clox_string(const char *chars, size_t length) {
+    return OBJ_VAL((Obj *)copy_str(chars, length));
+}
+
+Value clox_array(const double *items, size_t length) {
+    return OBJ_VAL((Obj *)copy_array(items, length));
+}
+
+const double *clox_array_items(Value value, size_t *length) {
+    if (!IS_ARRAY(value)) return NULL;
+    *length = AS_ARRAY(value)->length;
+    return AS_ARRAY(value)->items;
+}
+
+const char *clox_string_chars(Value value, size_t *length) {
+    if (!IS_STRING(value)) return NULL;
+    *length = AS_STRING(value)->length;
+    return AS_STRING(value)->chars;
+}
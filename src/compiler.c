@@ -2,8 +2,22 @@
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "globals.h"
+#include "native.h"
 #include "object.h"
+#include "pipeline.h"
+#include "probes.h"
 #include "scanner.h"
+#include "stack.h"
+#include "vm.h"
+
+extern VM vm;
+
+// How deeply expressions may nest, since the parser recurses for every
+// level. A level holds at most 255 call arguments on the value stack, so
+// nesting alone can't fill STACK_RESERVE, and the recursion stays well
+// under 1 MB of C stack.
+#define NESTING_MAX (STACK_RESERVE / (UINT8_MAX + 1))
 
 Parser parser;
 Chunk *chunk_compiling;
@@ -22,7 +36,7 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(bool can_assign);
 
 typedef struct {
     ParseFn prefix;
@@ -33,18 +47,22 @@ typedef struct {
 static void expression(void);
 static ParseRule *get_rule(TokenType type);
 static void parse_precedence(Precedence precedence);
-static void unary(void);
-static void binary(void);
-static void number(void);
-static void string(void);
-static void grouping(void);
-static void literal(void);
+static void unary(bool can_assign);
+static void binary(bool can_assign);
+static void number(bool can_assign);
+static void string(bool can_assign);
+static void grouping(bool can_assign);
+static void literal(bool can_assign);
+static void variable(bool can_assign);
+static void array(bool can_assign);
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {grouping, NULL, PREC_NONE},
     [TOKEN_RIGHT_PAREN] = {NULL, grouping, PREC_NONE},
     [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET] = {array, NULL, PREC_NONE},
+    [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
@@ -61,7 +79,7 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
     [TOKEN_STRING] = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, NULL, PREC_NONE},
@@ -113,7 +131,8 @@ static void error_at_last(const char *message) {
 static void consume(void) {
     parser.previous = parser.current;
     while (true) {
-        parser.current = scan_token();
+        parser.current =
+            parser.ring != NULL ? next_token(parser.ring) : scan_token();
         if (parser.current.type != TOKEN_ERROR) break;
         error_at_current(parser.current.start);
     }
@@ -124,6 +143,12 @@ static void consume_expected(TokenType type, const char *msg) {
     consume();
 }
 
+static bool match(TokenType type) {
+    if (parser.current.type != type) return false;
+    consume();
+    return true;
+}
+
 static void emit_byte(u8 byte) {
     write_chunk(chunk_current(), byte, parser.previous.line);
 }
@@ -135,6 +160,11 @@ static void emit_bytes(u8 b1, u8 b2) {
 
 static void emit_return(void) { emit_byte(OP_RETURN); }
 
+static void emit_slot(OpCode op, u16 slot) {
+    emit_byte(op);
+    emit_bytes((u8)(slot >> 8), (u8)slot);
+}
+
 static u8 make_constant(Value value) {
     size_t constant = add_constant(chunk_current(), value);
     if (constant > UINT8_MAX) {
@@ -157,44 +187,144 @@ static void end_compiler(void) {
 }
 
 static void parse_precedence(Precedence precedence) {
+    if (parser.depth == NESTING_MAX) {
+        error_at_current("Expression nests too deeply.");
+        return;
+    }
+    parser.depth++;
     consume();
     ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
     if (prefix_rule == NULL) {
         error_at_last("Expected expression.");
+        parser.depth--;
         return;
     }
 
-    prefix_rule();
+    bool can_assign = precedence <= PREC_ASSIGNMENT;
+    prefix_rule(can_assign);
 
     while (precedence <= get_rule(parser.current.type)->precedence) {
         consume();
         ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-        infix_rule();
+        infix_rule(can_assign);
+    }
+
+    if (can_assign && match(TOKEN_EQUAL)) {
+        error_at_last("Invalid assignment target.");
     }
+    parser.depth--;
 }
 
 static void expression(void) { parse_precedence(PREC_ASSIGNMENT); }
 
 static ParseRule *get_rule(TokenType type) { return &rules[type]; }
 
-static void grouping(void) {
+static void grouping(bool can_assign) {
+    (void)can_assign;
     expression();
     consume_expected(TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
 }
 
-static void number(void) {
-    double value = strtod(parser.previous.start, NULL);
-    emit_constant(NUMBER_VAL(value));
+static void number(bool can_assign) {
+    (void)can_assign;
+    if (parser.previous.integral) {
+        emit_constant(INT_VAL(parser.previous.integer));
+    } else {
+        emit_constant(NUMBER_VAL(parser.previous.number));
+    }
+}
+
+// Strings from a pinned source point into it, others need a copy that
+// outlives the source
+static ObjString *source_string(const char *chars, size_t length) {
+    return parser.borrow ? borrow_str(chars, length) : copy_str(chars, length);
 }
 
-static void string(void) {
+static void string(bool can_assign) {
+    (void)can_assign;
     // The start is + 1 to trim the leading '"', and
     // the length - 2 is to trim the trailing '"'
-    emit_constant(OBJ_VAL((Obj *)copy_str(parser.previous.start + 1,
-                                          parser.previous.length - 2)));
+    emit_constant(OBJ_VAL((Obj *)source_string(parser.previous.start + 1,
+                                               parser.previous.length - 2)));
+}
+
+// Parses the arguments of a call to the native whose name has just been
+// consumed, and emits the call, which is resolved to the native with that
+// name and number of arguments
+static void call(void) {
+    Token name = parser.previous;
+    consume_expected(TOKEN_LEFT_PAREN, "Expected '(' after function name.");
+    int args = 0;
+    if (parser.current.type != TOKEN_RIGHT_PAREN) {
+        do {
+            expression();
+            if (args == UINT8_MAX) {
+                error_at_last("Can't have more than 255 arguments.");
+            }
+            args++;
+            if (parser.current.type != TOKEN_COMMA) break;
+            consume();
+        } while (true);
+    }
+    consume_expected(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
+
+    bool named;
+    i32 index = find_native(&vm.natives, name.start, name.length, args, &named);
+    if (index < 0) {
+        error_at_last(named ? "Wrong number of arguments."
+                            : "Unknown function.");
+        return;
+    }
+    emit_bytes(OP_CALL_NATIVE, (u8)index);
 }
 
-static void unary(void) {
+// Resolves the global named by the identifier just consumed to its slot,
+// which makes one if the name hasn't been seen before
+static u16 identifier_slot(void) {
+    ObjString *name =
+        source_string(parser.previous.start, parser.previous.length);
+    i32 slot = global_slot(&vm.globals, name);
+    if (slot < 0) {
+        error_at_last("Too many global variables.");
+        return 0;
+    }
+    return (u16)slot;
+}
+
+static void variable(bool can_assign) {
+    if (parser.current.type == TOKEN_LEFT_PAREN) {
+        call();
+        return;
+    }
+    u16 slot = identifier_slot();
+    if (can_assign && match(TOKEN_EQUAL)) {
+        expression();
+        emit_slot(OP_SET_GLOBAL, slot);
+    } else {
+        emit_slot(OP_GET_GLOBAL, slot);
+    }
+}
+
+static void array(bool can_assign) {
+    (void)can_assign;
+    int count = 0;
+    if (parser.current.type != TOKEN_RIGHT_BRACKET) {
+        do {
+            expression();
+            if (count == UINT8_MAX) {
+                error_at_last("Can't have more than 255 elements in an array.");
+            }
+            count++;
+            if (parser.current.type != TOKEN_COMMA) break;
+            consume();
+        } while (true);
+    }
+    consume_expected(TOKEN_RIGHT_BRACKET, "Expected ']' after elements.");
+    emit_bytes(OP_ARRAY, (u8)count);
+}
+
+static void unary(bool can_assign) {
+    (void)can_assign;
     TokenType op_type = parser.previous.type;
 
     parse_precedence(PREC_UNARY);
@@ -206,7 +336,8 @@ static void unary(void) {
     }
 }
 
-static void binary(void) {
+static void binary(bool can_assign) {
+    (void)can_assign;
     TokenType op_type = parser.previous.type;
     ParseRule *rule = get_rule(op_type);
     parse_precedence((Precedence)(rule->precedence + 1));
@@ -226,7 +357,8 @@ static void binary(void) {
     }
 }
 
-static void literal(void) {
+static void literal(bool can_assign) {
+    (void)can_assign;
     switch (parser.previous.type) {
     case TOKEN_TRUE : emit_byte(OP_TRUE); break;
     case TOKEN_FALSE: emit_byte(OP_FALSE); break;
@@ -235,14 +367,52 @@ static void literal(void) {
     }
 }
 
+// var name [= initializer], which evaluates to the initial value
+static void var_declaration(void) {
+    consume_expected(TOKEN_IDENTIFIER, "Expected variable name.");
+    u16 slot = identifier_slot();
+    if (match(TOKEN_EQUAL)) {
+        expression();
+    } else {
+        emit_byte(OP_NIL);
+    }
+    emit_slot(OP_DEFINE_GLOBAL, slot);
+}
+
+static void item(void) {
+    if (match(TOKEN_VAR)) {
+        var_declaration();
+    } else {
+        expression();
+    }
+}
+
 bool compile(const char *source, Chunk *chunk) {
-    init_scanner(source);
+    PROBE1(compile_start, source);
+    // Only worth a thread when there is a lot to scan
+    parser.ring = NULL;
+    if (vm.pipeline_threshold != 0 &&
+        strlen(source) >= vm.pipeline_threshold) {
+        parser.ring = start_pipeline(source);
+    } else {
+        init_scanner(source);
+    }
     chunk_compiling = chunk;
+    parser.borrow = source_pinned(source);
     parser.had_error = false;
     parser.panic_mode = false;
+    parser.depth = 0;
     consume();
-    expression();
+    // Items are separated by semicolons and the program evaluates to the
+    // value of the last one
+    item();
+    while (match(TOKEN_SEMICOLON) && parser.current.type != TOKEN_EOF) {
+        emit_byte(OP_POP);
+        item();
+    }
     consume_expected(TOKEN_EOF, "Expected end of expression");
     end_compiler();
+    if (parser.ring != NULL) stop_pipeline(parser.ring);
+    PROBE2(compile_end, source, !parser.had_error);
     return !parser.had_error;
 }
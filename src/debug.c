@@ -1,33 +1,61 @@
 #include "debug.h"
 #include "chunk.h"
 #include "common.h"
+#include "globals.h"
+#include "object.h"
+#include "register.h"
 #include "value.h"
+#include "vm.h"
 
-static size_t instruction_simple(const char *name, int offset) {
-    printf("   %s\n", name);
+extern VM vm;
+
+static size_t instruction_simple(const char *name, size_t offset) {
+    write_fmt(&vm.out, "   %s\n", name);
     return offset + 1;
 }
 
-static size_t instruction_constant(const char *name, Chunk *chunk, u8 offset) {
+static size_t instruction_constant(const char *name, Chunk *chunk,
+                                   size_t offset) {
     u8 constant_index = chunk->code[offset + 1];
-    printf("   %-16s | %4u ", name, constant_index);
+    write_fmt(&vm.out, "   %-16s | %4u ", name, constant_index);
     print_Value(chunk->constants.items[constant_index]);
-    printf("\n");
+    write_char(&vm.out, '\n');
+    return offset + 2;
+}
+
+static size_t instruction_byte(const char *name, Chunk *chunk,
+                               size_t offset) {
+    write_fmt(&vm.out, "   %-16s | %4u\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static size_t instruction_native(Chunk *chunk, size_t offset) {
+    const Native *native = &vm.natives.items[chunk->code[offset + 1]];
+    write_fmt(&vm.out, "   %-16s | %4u %s/%u\n", "OP_CALL_NATIVE",
+              chunk->code[offset + 1], native->name, native->arity);
     return offset + 2;
 }
 
+static size_t instruction_slot(const char *name, Chunk *chunk,
+                               size_t offset) {
+    u16 slot = read_slot_operand(&chunk->code[offset + 1]);
+    ObjString *global = vm.globals.names[slot];
+    write_fmt(&vm.out, "   %-16s | %4u %.*s\n", name, slot,
+              (int)global->length, global->chars);
+    return offset + 3;
+}
+
+// lines.items[n] is the number of bytes on line n, so offset is on the
+// first line whose bytes reach past it
 size_t get_line(Chunk *chunk, size_t offset) {
-    size_t result = 0;
-    for (size_t i = 0; i <= offset;) {
-        i += chunk->lines.items[result];
-        result++;
-    }
-    return result;
+    size_t line = 0;
+    for (size_t end = 0; end <= offset;) end += chunk->lines.items[++line];
+    return line;
 }
 
 void disassemble_chunk(Chunk *chunk, const char *name) {
-    printf("== %s ==\n", name);
-    printf("Offset | Line | OP               | Constant\n");
+    write_fmt(&vm.out, "== %s ==\n", name);
+    write_cstr(&vm.out, "Offset | Line | OP               | Constant\n");
 
     for (size_t offset = 0; offset < chunk->count;) {
         offset = disassemble_instruction(chunk, offset);
@@ -35,8 +63,7 @@ void disassemble_chunk(Chunk *chunk, const char *name) {
 }
 
 size_t disassemble_instruction(Chunk *chunk, size_t offset) {
-    printf("%07zu ", offset);
-    printf("%4zu ", get_line(chunk, offset));
+    write_fmt(&vm.out, "%07zu %4zu ", offset, get_line(chunk, offset));
 
     u8 instruction = chunk->code[offset];
     switch (instruction) {
@@ -53,7 +80,104 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
     case OP_SUBTRACT: return instruction_simple("OP_SUBTRACT", offset);
     case OP_MULTIPLY: return instruction_simple("OP_MULTIPLY", offset);
     case OP_DIVIDE  : return instruction_simple("OP_DIVIDE", offset);
-    case OP_RETURN  : return instruction_simple("OP_RETURN", offset);
-    default         : printf("Unknown opcode %d\n", instruction); return offset + 1;
+    case OP_GET_GLOBAL:
+        return instruction_slot("OP_GET_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return instruction_slot("OP_SET_GLOBAL", chunk, offset);
+    case OP_DEFINE_GLOBAL:
+        return instruction_slot("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_POP: return instruction_simple("OP_POP", offset);
+    case OP_ARRAY       : return instruction_byte("OP_ARRAY", chunk, offset);
+    case OP_CALL_NATIVE : return instruction_native(chunk, offset);
+    case OP_RETURN      : return instruction_simple("OP_RETURN", offset);
+    case OP_ADD_NUM     : return instruction_simple("OP_ADD_NUM", offset);
+    case OP_ADD_STR     : return instruction_simple("OP_ADD_STR", offset);
+    case OP_SUBTRACT_NUM: return instruction_simple("OP_SUBTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM: return instruction_simple("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM  : return instruction_simple("OP_DIVIDE_NUM", offset);
+    case OP_GREATER_NUM : return instruction_simple("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM    : return instruction_simple("OP_LESS_NUM", offset);
+    case OP_ADD_INT     : return instruction_simple("OP_ADD_INT", offset);
+    case OP_SUBTRACT_INT: return instruction_simple("OP_SUBTRACT_INT", offset);
+    case OP_MULTIPLY_INT: return instruction_simple("OP_MULTIPLY_INT", offset);
+    case OP_DIVIDE_INT  : return instruction_simple("OP_DIVIDE_INT", offset);
+    case OP_GREATER_INT : return instruction_simple("OP_GREATER_INT", offset);
+    case OP_LESS_INT    : return instruction_simple("OP_LESS_INT", offset);
+    default:
+        write_fmt(&vm.out, "Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+}
+
+const char *opcode_name(u8 op) {
+    static const char *const names[] = {
+        [OP_CONSTANT] = "OP_CONSTANT",
+        [OP_NIL] = "OP_NIL",
+        [OP_TRUE] = "OP_TRUE",
+        [OP_FALSE] = "OP_FALSE",
+        [OP_NOT] = "OP_NOT",
+        [OP_EQUAL] = "OP_EQUAL",
+        [OP_GREATER] = "OP_GREATER",
+        [OP_LESS] = "OP_LESS",
+        [OP_NEGATE] = "OP_NEGATE",
+        [OP_ADD] = "OP_ADD",
+        [OP_SUBTRACT] = "OP_SUBTRACT",
+        [OP_MULTIPLY] = "OP_MULTIPLY",
+        [OP_DIVIDE] = "OP_DIVIDE",
+        [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+        [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+        [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+        [OP_POP] = "OP_POP",
+        [OP_ARRAY] = "OP_ARRAY",
+        [OP_CALL_NATIVE] = "OP_CALL_NATIVE",
+        [OP_RETURN] = "OP_RETURN",
+        [OP_ADD_NUM] = "OP_ADD_NUM",
+        [OP_ADD_STR] = "OP_ADD_STR",
+        [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+        [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+        [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+        [OP_GREATER_NUM] = "OP_GREATER_NUM",
+        [OP_LESS_NUM] = "OP_LESS_NUM",
+        [OP_ADD_INT] = "OP_ADD_INT",
+        [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+        [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+        [OP_DIVIDE_INT] = "OP_DIVIDE_INT",
+        [OP_GREATER_INT] = "OP_GREATER_INT",
+        [OP_LESS_INT] = "OP_LESS_INT",
+    };
+    if (op >= sizeof(names) / sizeof(names[0]) || names[op] == NULL) {
+        return "OP_UNKNOWN";
+    }
+    return names[op];
+}
+
+static const char *register_op_name(u8 op) {
+    switch (op) {
+    case ROP_NOT          : return "NOT";
+    case ROP_NEGATE       : return "NEGATE";
+    case ROP_EQUAL        : return "EQUAL";
+    case ROP_GREATER      : return "GREATER";
+    case ROP_LESS         : return "LESS";
+    case ROP_ADD          : return "ADD";
+    case ROP_SUBTRACT     : return "SUBTRACT";
+    case ROP_MULTIPLY     : return "MULTIPLY";
+    case ROP_DIVIDE       : return "DIVIDE";
+    case ROP_GET_GLOBAL   : return "GET_GLOBAL";
+    case ROP_SET_GLOBAL   : return "SET_GLOBAL";
+    case ROP_DEFINE_GLOBAL: return "DEFINE_GLOBAL";
+    case ROP_RETURN       : return "RETURN";
+    default               : return "UNKNOWN";
+    }
+}
+
+void disassemble_registers(RegChunk *reg_chunk, const char *name) {
+    write_fmt(&vm.out, "== %s ==\n", name);
+    write_cstr(&vm.out, "Index  | OP               | A     B     C\n");
+
+    for (size_t i = 0; i < reg_chunk->count; i++) {
+        RegInstruction *instruction = &reg_chunk->code[i];
+        write_fmt(&vm.out, "%07zu %-18s r%-5u r%-5u r%u\n", i,
+                  register_op_name(instruction->op), instruction->a,
+                  instruction->b, instruction->c);
     }
 }
@@ -0,0 +1,332 @@
+#include "dtoa.h"
+#include "common.h"
+
+#include <math.h>
+
+// Shortest round-trip formatting of doubles using Grisu2 (Florian Loitsch,
+// "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+// The digits it produces always parse back to the same double, and are the
+// shortest such digits for all but a tiny fraction of inputs.
+
+typedef struct {
+    u64 f;
+    int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK 0x7FF0000000000000ull
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DP_HIDDEN_BIT 0x0010000000000000ull
+
+// Normalized 64 bit approximations of 10^k for k = -348, -340, ..., 340
+static const DiyFp cached_powers[] = {
+    {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193},
+    {0x8b16fb203055ac76ull, -1166}, {0xcf42894a5dce35eaull, -1140},
+    {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+    {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034},
+    {0xbe5691ef416bd60cull, -1007}, {0x8dd01fad907ffc3cull, -980},
+    {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+    {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874},
+    {0x823c12795db6ce57ull, -847}, {0xc21094364dfb5637ull, -821},
+    {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+    {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715},
+    {0xb23867fb2a35b28eull, -688}, {0x84c8d4dfd2c63f3bull, -661},
+    {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+    {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555},
+    {0xf3e2f893dec3f126ull, -529}, {0xb5b5ada8aaff80b8ull, -502},
+    {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+    {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396},
+    {0xa6dfbd9fb8e5b88full, -369}, {0xf8a95fcf88747d94ull, -343},
+    {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+    {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236},
+    {0xe45c10c42a2b3b06ull, -210}, {0xaa242499697392d3ull, -183},
+    {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+    {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77},
+    {0x9c40000000000000ull, -50}, {0xe8d4a51000000000ull, -24},
+    {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+    {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83},
+    {0xd5d238a4abe98068ull, 109}, {0x9f4f2726179a2245ull, 136},
+    {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+    {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242},
+    {0x924d692ca61be758ull, 269}, {0xda01ee641a708deaull, 295},
+    {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+    {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402},
+    {0xc83553c5c8965d3dull, 428}, {0x952ab45cfa97a0b3ull, 455},
+    {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+    {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561},
+    {0x88fcf317f22241e2ull, 588}, {0xcc20ce9bd35c78a5ull, 614},
+    {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+    {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720},
+    {0xbb764c4ca7a44410ull, 747}, {0x8bab8eefb6409c1aull, 774},
+    {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+    {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880},
+    {0x80444b5e7aa7cf85ull, 907}, {0xbf21e44003acdd2dull, 933},
+    {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+    {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039},
+    {0xaf87023b9bf0ee6bull, 1066},
+};
+
+static const u32 pow10_table[] = {1,      10,      100,      1000,      10000,
+                                   100000, 1000000, 10000000, 100000000,
+                                   1000000000};
+
+// Scales the distance to the upper boundary up to the digits generated
+// past the decimal point, of which there can be up to 19
+static const u64 pow10_wide[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+static DiyFp diyfp_from_double(double value) {
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_e = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    u64 significand = bits & DP_SIGNIFICAND_MASK;
+
+    DiyFp result;
+    if (biased_e != 0) {
+        result.f = significand + DP_HIDDEN_BIT;
+        result.e = biased_e - DP_EXPONENT_BIAS;
+    } else {
+        result.f = significand;
+        result.e = DP_MIN_EXPONENT + 1;
+    }
+    return result;
+}
+
+static DiyFp diyfp_multiply(DiyFp a, DiyFp b) {
+    const u64 m32 = 0xFFFFFFFFu;
+    u64 ah = a.f >> 32, al = a.f & m32;
+    u64 bh = b.f >> 32, bl = b.f & m32;
+    u64 hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+    u64 tmp = (ll >> 32) + (hl & m32) + (lh & m32);
+    tmp += 1u << 31; // Round
+    DiyFp result = {hh + (hl >> 32) + (lh >> 32) + (tmp >> 32), a.e + b.e + 64};
+    return result;
+}
+
+static DiyFp diyfp_normalize(DiyFp value) {
+    int shift = __builtin_clzll(value.f);
+    value.f <<= shift;
+    value.e -= shift;
+    return value;
+}
+
+// Computes the boundaries m- and m+ halfway between value and its
+// neighbours, both with the exponent of the normalized m+
+static void normalized_boundaries(DiyFp value, DiyFp *minus, DiyFp *plus) {
+    DiyFp pl = {(value.f << 1) + 1, value.e - 1};
+    pl = diyfp_normalize(pl);
+
+    DiyFp mi;
+    if (value.f == DP_HIDDEN_BIT) {
+        mi.f = (value.f << 2) - 1;
+        mi.e = value.e - 2;
+    } else {
+        mi.f = (value.f << 1) - 1;
+        mi.e = value.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+
+    *minus = mi;
+    *plus = pl;
+}
+
+static DiyFp cached_power(int e, int *k) {
+    // 0.30102999566398114 = 1 / log2(10)
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) ik++;
+
+    unsigned index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    return cached_powers[index];
+}
+
+static int count_digits(u32 n) {
+    int digits = 1;
+    while (digits < 10 && n >= pow10_table[digits]) digits++;
+    return digits;
+}
+
+static void grisu_round(char *buffer, int length, u64 delta, u64 rest,
+                        u64 ten_kappa, u64 wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w ||
+            wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void digit_gen(DiyFp w, DiyFp mp, u64 delta, char *buffer, int *length,
+                      int *k) {
+    DiyFp one = {1ull << -mp.e, mp.e};
+    u64 wp_w = mp.f - w.f;
+    u32 p1 = (u32)(mp.f >> -one.e);
+    u64 p2 = mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    *length = 0;
+
+    while (kappa > 0) {
+        u32 d = p1 / pow10_table[kappa - 1];
+        p1 %= pow10_table[kappa - 1];
+        if (d || *length) buffer[(*length)++] = (char)('0' + d);
+        kappa--;
+
+        u64 tmp = ((u64)p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisu_round(buffer, *length, delta, tmp,
+                        (u64)pow10_table[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    while (true) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *length) buffer[(*length)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+
+        if (p2 < delta) {
+            *k += kappa;
+            int index = -kappa;
+            grisu_round(buffer, *length, delta, p2, one.f,
+                        wp_w * (index < 20 ? pow10_wide[index] : 0));
+            return;
+        }
+    }
+}
+
+// Writes the shortest digits of a positive, finite, non-zero value into
+// buffer so that value = digits * 10^k
+static int grisu2(double value, char *buffer, int *k) {
+    DiyFp v = diyfp_from_double(value);
+    DiyFp w_minus, w_plus;
+    normalized_boundaries(v, &w_minus, &w_plus);
+
+    DiyFp c_mk = cached_power(w_plus.e, k);
+    DiyFp w = diyfp_multiply(diyfp_normalize(v), c_mk);
+    DiyFp wp = diyfp_multiply(w_plus, c_mk);
+    DiyFp wm = diyfp_multiply(w_minus, c_mk);
+    wm.f++;
+    wp.f--;
+
+    int length;
+    digit_gen(w, wp, wp.f - wm.f, buffer, &length, k);
+    return length;
+}
+
+static size_t format_u64(u64 value, char *buffer) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t i = 0; i < count; i++) buffer[i] = digits[count - 1 - i];
+    return count;
+}
+
+// Lays out the digits the same way printf's %g does, but with as many
+// significant digits as the shortest representation needs
+static size_t format_digits(char *buffer, const char *digits, int length,
+                            int k) {
+    int exponent = length + k - 1;
+    char *out = buffer;
+
+    if (exponent < -4 || exponent >= DTOA_MAX_DIGITS) {
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, length - 1);
+            out += length - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        if (exponent < 0) exponent = -exponent;
+        if (exponent < 10) *out++ = '0';
+        out += format_u64((u64)exponent, out);
+    } else if (exponent < 0) {
+        // 0.000ddd
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = -1; i > exponent; i--) *out++ = '0';
+        memcpy(out, digits, length);
+        out += length;
+    } else if (exponent + 1 >= length) {
+        // ddd000
+        memcpy(out, digits, length);
+        out += length;
+        for (int i = length; i <= exponent; i++) *out++ = '0';
+    } else {
+        // ddd.ddd
+        memcpy(out, digits, exponent + 1);
+        out += exponent + 1;
+        *out++ = '.';
+        memcpy(out, digits + exponent + 1, length - exponent - 1);
+        out += length - exponent - 1;
+    }
+
+    *out = '\0';
+    return (size_t)(out - buffer);
+}
+
+size_t format_double(double value, char *buffer) {
+    char *out = buffer;
+
+    if (value != value) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value == HUGE_VAL) {
+        memcpy(out, "inf", 4);
+        return (size_t)(out - buffer) + 3;
+    }
+    if (value == 0) {
+        memcpy(out, "0", 2);
+        return (size_t)(out - buffer) + 1;
+    }
+
+    // Integers that fit in the significand are by far the most common
+    // numbers printed and don't need the full digit generation
+    if (value < DTOA_EXACT_INTEGER && value == (double)(u64)value) {
+        out += format_u64((u64)value, out);
+        *out = '\0';
+        return (size_t)(out - buffer);
+    }
+
+    char digits[DTOA_MAX_DIGITS + 1];
+    int k;
+    int length = grisu2(value, digits, &k);
+    return (size_t)(out - buffer) + format_digits(out, digits, length, k);
+}
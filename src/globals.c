@@ -0,0 +1,46 @@
+#include "globals.h"
+#include "common.h"
+#include "memory.h"
+#include "table.h"
+
+void init_globals(Globals *globals) {
+    init_table(&globals->slots);
+    globals->count = 0;
+    globals->alloc = 0;
+    globals->values = NULL;
+    globals->names = NULL;
+}
+
+void free_globals(Globals *globals) {
+    free_table(&globals->slots);
+    FREE_ARRAY(Value, globals->values, globals->alloc);
+    FREE_ARRAY(ObjString *, globals->names, globals->alloc);
+    init_globals(globals);
+}
+
+bool find_global(Globals *globals, ObjString *name, u32 *slot) {
+    Value index;
+    if (!table_get(&globals->slots, name, &index)) return false;
+    *slot = (u32)AS_INT(index);
+    return true;
+}
+
+i32 global_slot(Globals *globals, ObjString *name) {
+    u32 slot;
+    if (find_global(globals, name, &slot)) return (i32)slot;
+    if (globals->count == GLOBALS_MAX) return -1;
+
+    if (globals->alloc < globals->count + 1) {
+        size_t old_alloc = globals->alloc;
+        globals->alloc = GROW_CAPACITY(old_alloc);
+        globals->values =
+            GROW_ARRAY(Value, globals->values, old_alloc, globals->alloc);
+        globals->names =
+            GROW_ARRAY(ObjString *, globals->names, old_alloc, globals->alloc);
+    }
+    slot = (u32)globals->count++;
+    globals->values[slot] = UNDEFINED_VAL;
+    globals->names[slot] = name;
+    table_set(&globals->slots, name, INT_VAL(slot));
+    return (i32)slot;
+}
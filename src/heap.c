@@ -0,0 +1,264 @@
+#include "heap.h"
+#include "common.h"
+#include "intern.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+extern VM vm;
+
+// Lengths are bucketed by powers of two: bucket i holds strings shorter
+// than 2^i characters and at least 2^(i - 1) long
+#define LENGTH_BUCKETS 33
+// Bytes of a string shown, never splitting a character
+#define PREVIEW_LENGTH 64
+
+static const char *type_names[] = {
+    [OBJ_STRING] = "string",
+    [OBJ_ARRAY]  = "array",
+};
+
+#define OBJ_TYPES (sizeof(type_names) / sizeof(type_names[0]))
+
+typedef struct {
+    size_t count, alloc;
+    ObjString **items;
+} StringList;
+
+static void append_string(StringList *list, ObjString *string) {
+    if (list->alloc < list->count + 1) {
+        size_t old_alloc = list->alloc;
+        list->alloc = GROW_CAPACITY(old_alloc);
+        list->items =
+            GROW_ARRAY(ObjString *, list->items, old_alloc, list->alloc);
+    }
+    list->items[list->count++] = string;
+}
+
+static size_t string_bytes(ObjString *string) {
+    if (string->borrowed) return sizeof(ObjString);
+    return sizeof(ObjString) + string->length + 1;
+}
+
+static size_t length_bucket(size_t length) {
+    size_t bucket = 0;
+    while (length > 0 && bucket < LENGTH_BUCKETS - 1) {
+        length >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Length of the UTF-8 sequence at chars, or 0 if it isn't a valid one:
+// truncated, overlong, a surrogate or past U+10FFFF
+static size_t utf8_length(const u8 *chars, size_t available) {
+    // Smallest code point that needs a sequence of each length
+    static const u32 min_code_points[] = {0, 0, 0x80, 0x800, 0x10000};
+
+    u8 c = chars[0];
+    if (c < 0x80) return 1;
+    size_t length = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+    if (c < 0xc2 || c > 0xf4 || length > available) return 0;
+
+    u32 code_point = c & (0x7f >> length);
+    for (size_t i = 1; i < length; i++) {
+        if ((chars[i] & 0xc0) != 0x80) return 0;
+        code_point = code_point << 6 | (chars[i] & 0x3f);
+    }
+    if (code_point < min_code_points[length] || code_point > 0x10ffff ||
+        (code_point >= 0xd800 && code_point <= 0xdfff)) {
+        return 0;
+    }
+    return length;
+}
+
+// UTF-8 is written as it is. Control characters are escaped, and so are
+// bytes that aren't part of valid UTF-8, as the code point of the same
+// value, since JSON can't hold them otherwise.
+static void write_json_string(FILE *file, const char *chars, size_t length) {
+    const u8 *bytes = (const u8 *)chars;
+    size_t shown = length < PREVIEW_LENGTH ? length : PREVIEW_LENGTH;
+    size_t i = 0;
+    fputc('"', file);
+    while (i < shown) {
+        u8 c = bytes[i];
+        size_t sequence = utf8_length(bytes + i, length - i);
+        if (sequence > 1) {
+            if (i + sequence > shown) break;
+            fwrite(bytes + i, 1, sequence, file);
+            i += sequence;
+            continue;
+        }
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (sequence == 0 || c < 0x20 || c == 0x7f) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+        i++;
+    }
+    if (i < length) fputs("...", file);
+    fputc('"', file);
+}
+
+static int by_length(const void *a, const void *b) {
+    size_t x = (*(ObjString *const *)a)->length;
+    size_t y = (*(ObjString *const *)b)->length;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Orders equal contents next to each other
+static int by_contents(const void *a, const void *b) {
+    ObjString *x = *(ObjString *const *)a, *y = *(ObjString *const *)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return memcmp(x->chars, y->chars, x->length);
+}
+
+// Intern sets never remove strings, so tombstones are always 0. They are
+// still reported so that the census keeps the same shape.
+static void dump_intern_table(FILE *file) {
+    size_t live = 0, tombstones = 0, capacity = 0;
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternSet *set = &vm.strings.shards[i].set;
+        capacity += set->capacity;
+        live += set->count;
+    }
+
+    double used = capacity == 0 ? 0 : (double)(live + tombstones) / capacity;
+    double dead =
+        live + tombstones == 0 ? 0 : (double)tombstones / (live + tombstones);
+    fprintf(file,
+            "  \"intern_table\": {\"shards\": %d, \"capacity\": %zu, "
+            "\"bytes\": %zu, \"live\": %zu, \"tombstones\": %zu, "
+            "\"load_factor\": %.4f, \"tombstone_ratio\": %.4f},\n",
+            INTERN_SHARDS, capacity, capacity * sizeof(uintptr_t), live,
+            tombstones, used, dead);
+}
+
+// Runs of equal contents in a list sorted by_contents, most copies first
+typedef struct {
+    ObjString *string;
+    size_t copies;
+} Duplicate;
+
+static int by_copies(const void *a, const void *b) {
+    const Duplicate *x = a, *y = b;
+    if (x->copies != y->copies) return x->copies < y->copies ? 1 : -1;
+    return by_length(&x->string, &y->string);
+}
+
+static void dump_duplicates(FILE *file, StringList *strings) {
+    if (strings->count > 1) {
+        qsort(strings->items, strings->count, sizeof(ObjString *),
+              by_contents);
+    }
+
+    Duplicate *runs = ALLOCATE(Duplicate, strings->count + 1);
+    size_t run_count = 0, extra_copies = 0, wasted = 0;
+    for (size_t i = 0; i < strings->count;) {
+        size_t j = i + 1;
+        while (j < strings->count &&
+               by_contents(&strings->items[i], &strings->items[j]) == 0) {
+            j++;
+        }
+        if (j - i > 1) {
+            runs[run_count++] = (Duplicate){strings->items[i], j - i};
+            extra_copies += j - i - 1;
+            wasted += (j - i - 1) * string_bytes(strings->items[i]);
+        }
+        i = j;
+    }
+    if (run_count > 1) qsort(runs, run_count, sizeof(Duplicate), by_copies);
+
+    fprintf(file,
+            "  \"duplicates\": {\"distinct\": %zu, \"extra_copies\": %zu, "
+            "\"wasted_bytes\": %zu, \"top\": [",
+            run_count, extra_copies, wasted);
+    for (size_t i = 0; i < run_count && i < HEAP_DUPLICATED_STRINGS; i++) {
+        fprintf(file, "%s\n    {\"copies\": %zu, \"length\": %zu, \"chars\": ",
+                i == 0 ? "" : ",", runs[i].copies, runs[i].string->length);
+        write_json_string(file, runs[i].string->chars, runs[i].string->length);
+        fputc('}', file);
+    }
+    fprintf(file, "%s]}\n", run_count == 0 ? "" : "\n  ");
+    FREE_ARRAY(Duplicate, runs, strings->count + 1);
+}
+
+void dump_heap(FILE *file) {
+    size_t counts[OBJ_TYPES] = {0}, bytes[OBJ_TYPES] = {0};
+    size_t histogram[LENGTH_BUCKETS] = {0};
+    size_t interned = 0, borrowed = 0;
+    StringList strings = {0, 0, NULL};
+
+    for (Obj *object = vm.objects; object != NULL; object = object->next) {
+        switch (object->type) {
+        case OBJ_STRING: {
+            ObjString *string = (ObjString *)object;
+            counts[OBJ_STRING]++;
+            bytes[OBJ_STRING] += string_bytes(string);
+            histogram[length_bucket(string->length)]++;
+            if (string->interned) interned++;
+            if (string->borrowed) borrowed++;
+            append_string(&strings, string);
+            break;
+        }
+        case OBJ_ARRAY:
+            counts[OBJ_ARRAY]++;
+            bytes[OBJ_ARRAY] += sizeof(ObjArray) +
+                                ((ObjArray *)object)->padded * sizeof(double);
+            break;
+        }
+    }
+
+    size_t total_count = 0, total_bytes = 0;
+    fprintf(file, "{\n  \"objects\": {");
+    for (size_t i = 0; i < OBJ_TYPES; i++) {
+        fprintf(file, "\"%s\": {\"count\": %zu, \"bytes\": %zu}, ",
+                type_names[i], counts[i], bytes[i]);
+        total_count += counts[i];
+        total_bytes += bytes[i];
+    }
+    fprintf(file, "\"total\": {\"count\": %zu, \"bytes\": %zu}},\n",
+            total_count, total_bytes);
+    // Objects loaded from a snapshot live in its mapping rather than on the
+    // object list, so they are only accounted for as a whole
+    fprintf(file, "  \"snapshot\": {\"bytes\": %zu},\n", vm.snapshot_size);
+
+    fprintf(file,
+            "  \"strings\": {\"interned\": %zu, \"uninterned\": %zu, "
+            "\"borrowed\": %zu, \"length_histogram\": [",
+            interned, counts[OBJ_STRING] - interned, borrowed);
+    bool first = true;
+    for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+        if (histogram[i] == 0) continue;
+        // Bucket 0 only holds the empty string
+        size_t below = i == 0 ? 1 : (size_t)1 << i;
+        fprintf(file, "%s{\"below\": %zu, \"count\": %zu}",
+                first ? "" : ", ", below, histogram[i]);
+        first = false;
+    }
+    fprintf(file, "]},\n");
+
+    dump_intern_table(file);
+
+    if (strings.count > 1) {
+        qsort(strings.items, strings.count, sizeof(ObjString *), by_length);
+    }
+    fprintf(file, "  \"largest_strings\": [");
+    for (size_t i = 0; i < strings.count && i < HEAP_LARGEST_STRINGS; i++) {
+        fprintf(file, "%s\n    {\"length\": %zu, \"interned\": %s, "
+                "\"chars\": ",
+                i == 0 ? "" : ",", strings.items[i]->length,
+                strings.items[i]->interned ? "true" : "false");
+        write_json_string(file, strings.items[i]->chars,
+                          strings.items[i]->length);
+        fputc('}', file);
+    }
+    fprintf(file, "%s],\n", strings.count == 0 ? "" : "\n  ");
+
+    dump_duplicates(file, &strings);
+    fprintf(file, "}\n");
+    FREE_ARRAY(ObjString *, strings.items, strings.alloc);
+}
@@ -0,0 +1,98 @@
+#include "intern.h"
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "probes.h"
+
+#define INTERN_MAX_LOAD 0.75
+
+void init_intern_table(InternTable *strings) {
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_init(&strings->shards[i].lock, NULL);
+        init_intern_set(&strings->shards[i].set);
+    }
+}
+
+void free_intern_table(InternTable *strings) {
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        free_intern_set(&strings->shards[i].set);
+        pthread_mutex_destroy(&strings->shards[i].lock);
+    }
+}
+
+// Tables pick a slot with the low bits of the hash, so shards are picked
+// with the high ones to keep the two independent
+InternShard *intern_shard(InternTable *strings, u32 hash) {
+    return &strings->shards[hash >> (32 - INTERN_SHARD_BITS)];
+}
+
+void init_intern_set(InternSet *set) {
+    set->count = 0;
+    set->capacity = 0;
+    set->slots = NULL;
+}
+
+void free_intern_set(InternSet *set) {
+    FREE_ARRAY(uintptr_t, set->slots, set->capacity);
+    init_intern_set(set);
+}
+
+// Mixed so that the tag doesn't repeat the low bits the slot was picked
+// with, nor the high ones that picked the shard
+static uintptr_t intern_tag(u32 hash) {
+    return (uintptr_t)((hash * 0x9E3779B1u) >> 16) << INTERN_TAG_SHIFT;
+}
+
+static ObjString *slot_string(uintptr_t slot) {
+    return (ObjString *)(slot & INTERN_ADDRESS_MASK);
+}
+
+ObjString *intern_set_find(InternSet *set, const char *chars, size_t length,
+                           u32 hash) {
+    if (set->count == 0) return NULL;
+
+    uintptr_t tag = intern_tag(hash);
+    size_t mask = set->capacity - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+        uintptr_t slot = set->slots[index];
+        if (slot == 0) return NULL;
+        if ((slot & ~INTERN_ADDRESS_MASK) != tag) continue;
+
+        ObjString *string = slot_string(slot);
+        if (string->hash == hash && string->length == length &&
+            memcmp(string->chars, chars, length) == 0) {
+            return string;
+        }
+    }
+}
+
+static void insert_slot(uintptr_t *slots, size_t capacity, u32 hash,
+                        uintptr_t slot) {
+    size_t mask = capacity - 1;
+    size_t index = hash & mask;
+    while (slots[index] != 0) index = (index + 1) & mask;
+    slots[index] = slot;
+}
+
+static void resize_intern_set(InternSet *set, size_t capacity) {
+    PROBE3(resize_intern_set, set, set->capacity, capacity);
+    uintptr_t *slots = ALLOCATE(uintptr_t, capacity);
+    memset(slots, 0, capacity * sizeof(uintptr_t));
+    for (size_t i = 0; i < set->capacity; i++) {
+        uintptr_t slot = set->slots[i];
+        if (slot == 0) continue;
+        insert_slot(slots, capacity, slot_string(slot)->hash, slot);
+    }
+    FREE_ARRAY(uintptr_t, set->slots, set->capacity);
+    set->slots = slots;
+    set->capacity = capacity;
+}
+
+void intern_set_add(InternSet *set, ObjString *string) {
+    if (set->count + 1 > set->capacity * INTERN_MAX_LOAD) {
+        resize_intern_set(set, GROW_CAPACITY(set->capacity));
+    }
+    insert_slot(set->slots, set->capacity, string->hash,
+                (uintptr_t)string | intern_tag(string->hash));
+    set->count++;
+}
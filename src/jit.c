@@ -0,0 +1,498 @@
+#include "jit.h"
+#include "array.h"
+#include "chunk.h"
+#include "common.h"
+#include "globals.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+extern VM vm;
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Registers in the generated code:
+//   rbx  cached copy of vm.stack_top
+//   r12  &vm.stack_top, for syncing it before and after calling helpers
+// Values are 16 bytes, the type in the first 4 and the payload at offset 8,
+// so the top of the stack is at [rbx - 16] and its payload at [rbx - 8].
+
+typedef struct {
+    size_t count, alloc;
+    u8 *code;
+} CodeBuffer;
+
+static void emit(CodeBuffer *buffer, const u8 *bytes, size_t length) {
+    if (buffer->alloc < buffer->count + length) {
+        size_t old_alloc = buffer->alloc;
+        buffer->alloc = GROW_CAPACITY(old_alloc);
+        while (buffer->alloc < buffer->count + length) {
+            buffer->alloc = GROW_CAPACITY(buffer->alloc);
+        }
+        buffer->code = GROW_ARRAY(u8, buffer->code, old_alloc, buffer->alloc);
+    }
+    memcpy(buffer->code + buffer->count, bytes, length);
+    buffer->count += length;
+}
+
+#define EMIT(buffer, ...)                                                      \
+    do {                                                                       \
+        const u8 bytes[] = {__VA_ARGS__};                                      \
+        emit(buffer, bytes, sizeof(bytes));                                    \
+    } while (false)
+
+static void emit_u32(CodeBuffer *buffer, u32 value) {
+    emit(buffer, (const u8 *)&value, sizeof(value));
+}
+
+static void emit_u64(CodeBuffer *buffer, u64 value) {
+    emit(buffer, (const u8 *)&value, sizeof(value));
+}
+
+// Emits a jump with a 32 bit displacement and returns where the
+// displacement is, to be filled in by patch_jump()
+static size_t emit_jump(CodeBuffer *buffer, const u8 *opcode, size_t length) {
+    emit(buffer, opcode, length);
+    emit_u32(buffer, 0);
+    return buffer->count - 4;
+}
+
+static void patch_jump(CodeBuffer *buffer, size_t at) {
+    u32 displacement = (u32)(buffer->count - (at + 4));
+    memcpy(buffer->code + at, &displacement, sizeof(displacement));
+}
+
+static const u8 JE[] = {0x0F, 0x84};
+static const u8 JNE[] = {0x0F, 0x85};
+static const u8 JO[] = {0x0F, 0x80};
+static const u8 JMP[] = {0xE9};
+
+static void emit_epilogue(CodeBuffer *buffer) {
+    // pop r13; pop r12; pop rbx; ret
+    EMIT(buffer, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+}
+
+static InterpretResult jit_helper(u32 op, u32 offset);
+
+// Calls jit_helper(op, offset) with vm.stack_top synced, returning from the
+// generated code if it reports an error
+static void emit_helper_call(CodeBuffer *buffer, u8 op, size_t offset) {
+    EMIT(buffer, 0x49, 0x89, 0x1C, 0x24); // mov [r12], rbx
+    EMIT(buffer, 0xBF);                   // mov edi, op
+    emit_u32(buffer, op);
+    EMIT(buffer, 0xBE); // mov esi, offset
+    emit_u32(buffer, (u32)offset);
+    EMIT(buffer, 0x48, 0xB8); // mov rax, jit_helper
+    InterpretResult (*helper)(u32, u32) = jit_helper;
+    u64 address;
+    memcpy(&address, &helper, sizeof(address));
+    emit_u64(buffer, address);
+    EMIT(buffer, 0xFF, 0xD0); // call rax
+    EMIT(buffer, 0x85, 0xC0); // test eax, eax
+    EMIT(buffer, 0x74, 6);    // jz over the epilogue
+    emit_epilogue(buffer);
+    EMIT(buffer, 0x49, 0x8B, 0x1C, 0x24); // mov rbx, [r12]
+}
+
+// Jumps to the returned slow path unless both operands are numbers
+static void emit_number_guards(CodeBuffer *buffer, size_t *slow, int operands) {
+    EMIT(buffer, 0x83, 0x7B, 0xF0, VAL_NUMBER); // cmp dword [rbx-16], type
+    slow[0] = emit_jump(buffer, JNE, sizeof(JNE));
+    if (operands == 2) {
+        EMIT(buffer, 0x83, 0x7B, 0xE0, VAL_NUMBER); // cmp dword [rbx-32], type
+        slow[1] = emit_jump(buffer, JNE, sizeof(JNE));
+    }
+}
+
+// Stores the boolean in al over the second operand and pops the first
+static void emit_store_bool(CodeBuffer *buffer) {
+    EMIT(buffer, 0x0F, 0xB6, 0xC0);                         // movzx eax, al
+    EMIT(buffer, 0xC7, 0x43, 0xE0, VAL_BOOL, 0x00, 0x00, 0x00); // mov [rbx-32]
+    EMIT(buffer, 0x48, 0x89, 0x43, 0xE8); // mov [rbx-24], rax
+    EMIT(buffer, 0x48, 0x83, 0xEB, 0x10); // sub rbx, 16
+}
+
+// Emits the inlined integer case of an instruction, if it has one, and
+// returns whether it did. Operands that aren't both integers jump to
+// not_int, results that overflow to overflow, and the jump past the other
+// cases once the integer one is done is returned in done.
+static bool emit_int_case(CodeBuffer *buffer, u8 op, size_t *not_int,
+                          size_t *overflow, size_t *done) {
+    if (op == OP_DIVIDE) return false;
+
+    EMIT(buffer, 0x83, 0x7B, 0xF0, VAL_INT); // cmp dword [rbx-16], VAL_INT
+    not_int[0] = emit_jump(buffer, JNE, sizeof(JNE));
+    *overflow = 0;
+    if (op == OP_NEGATE) {
+        EMIT(buffer, 0x48, 0xF7, 0x5B, 0xF8); // neg qword [rbx-8]
+        // Negating INT64_MIN leaves it as it was
+        *overflow = emit_jump(buffer, JO, sizeof(JO));
+        *done = emit_jump(buffer, JMP, sizeof(JMP));
+        return true;
+    }
+    EMIT(buffer, 0x83, 0x7B, 0xE0, VAL_INT); // cmp dword [rbx-32], VAL_INT
+    not_int[1] = emit_jump(buffer, JNE, sizeof(JNE));
+
+    EMIT(buffer, 0x48, 0x8B, 0x43, 0xE8); // mov rax, [rbx-24]
+    switch (op) {
+    case OP_ADD     : EMIT(buffer, 0x48, 0x03, 0x43, 0xF8); break;
+    case OP_SUBTRACT: EMIT(buffer, 0x48, 0x2B, 0x43, 0xF8); break;
+    case OP_MULTIPLY: EMIT(buffer, 0x48, 0x0F, 0xAF, 0x43, 0xF8); break;
+    default         : EMIT(buffer, 0x48, 0x3B, 0x43, 0xF8); break; // cmp
+    }
+    switch (op) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+        *overflow = emit_jump(buffer, JO, sizeof(JO));
+        EMIT(buffer, 0x48, 0x89, 0x43, 0xE8); // mov [rbx-24], rax
+        EMIT(buffer, 0x48, 0x83, 0xEB, 0x10); // sub rbx, 16
+        break;
+    case OP_GREATER:
+        EMIT(buffer, 0x0F, 0x9F, 0xC0); // setg al
+        emit_store_bool(buffer);
+        break;
+    case OP_LESS:
+        EMIT(buffer, 0x0F, 0x9C, 0xC0); // setl al
+        emit_store_bool(buffer);
+        break;
+    case OP_EQUAL:
+        EMIT(buffer, 0x0F, 0x94, 0xC0); // sete al
+        emit_store_bool(buffer);
+        break;
+    }
+    *done = emit_jump(buffer, JMP, sizeof(JMP));
+    return true;
+}
+
+// Emits the inlined integer and number cases of an instruction followed by
+// a call to the helper for everything else
+static void emit_guarded(CodeBuffer *buffer, u8 op, size_t offset) {
+    size_t slow[2], not_int[2], overflow, int_done;
+    int operands = op == OP_NEGATE ? 1 : 2;
+    bool has_int = emit_int_case(buffer, op, not_int, &overflow, &int_done);
+    if (has_int) {
+        for (int i = 0; i < operands; i++) patch_jump(buffer, not_int[i]);
+    }
+    emit_number_guards(buffer, slow, operands);
+
+    switch (op) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE: {
+        u8 sse_op = op == OP_ADD        ? 0x58
+                    : op == OP_SUBTRACT ? 0x5C
+                    : op == OP_MULTIPLY ? 0x59
+                                        : 0x5E;
+        EMIT(buffer, 0xF2, 0x0F, 0x10, 0x43, 0xE8);   // movsd xmm0, [rbx-24]
+        EMIT(buffer, 0xF2, 0x0F, sse_op, 0x43, 0xF8); // op xmm0, [rbx-8]
+        EMIT(buffer, 0xF2, 0x0F, 0x11, 0x43, 0xE8);   // movsd [rbx-24], xmm0
+        EMIT(buffer, 0x48, 0x83, 0xEB, 0x10);         // sub rbx, 16
+        break;
+    }
+    case OP_GREATER:
+        EMIT(buffer, 0xF2, 0x0F, 0x10, 0x43, 0xE8); // movsd xmm0, [rbx-24]
+        EMIT(buffer, 0x66, 0x0F, 0x2E, 0x43, 0xF8); // ucomisd xmm0, [rbx-8]
+        EMIT(buffer, 0x0F, 0x97, 0xC0);             // seta al
+        emit_store_bool(buffer);
+        break;
+    case OP_LESS:
+        EMIT(buffer, 0xF2, 0x0F, 0x10, 0x43, 0xF8); // movsd xmm0, [rbx-8]
+        EMIT(buffer, 0x66, 0x0F, 0x2E, 0x43, 0xE8); // ucomisd xmm0, [rbx-24]
+        EMIT(buffer, 0x0F, 0x97, 0xC0);             // seta al
+        emit_store_bool(buffer);
+        break;
+    case OP_EQUAL:
+        EMIT(buffer, 0xF2, 0x0F, 0x10, 0x43, 0xE8); // movsd xmm0, [rbx-24]
+        EMIT(buffer, 0x66, 0x0F, 0x2E, 0x43, 0xF8); // ucomisd xmm0, [rbx-8]
+        EMIT(buffer, 0x0F, 0x94, 0xC0);             // sete al
+        EMIT(buffer, 0x0F, 0x9B, 0xC1);             // setnp cl
+        EMIT(buffer, 0x20, 0xC8);                   // and al, cl
+        emit_store_bool(buffer);
+        break;
+    case OP_NEGATE:
+        EMIT(buffer, 0x48, 0x0F, 0xBA, 0x7B, 0xF8, 0x3F); // btc [rbx-8], 63
+        break;
+    }
+
+    size_t done = emit_jump(buffer, JMP, sizeof(JMP));
+    for (int i = 0; i < operands; i++) patch_jump(buffer, slow[i]);
+    if (has_int && overflow != 0) patch_jump(buffer, overflow);
+    emit_helper_call(buffer, op, offset);
+    patch_jump(buffer, done);
+    if (has_int) patch_jump(buffer, int_done);
+}
+
+static void emit_push_literal(CodeBuffer *buffer, ValueType type, u32 bits) {
+    EMIT(buffer, 0xC7, 0x03); // mov dword [rbx], type
+    emit_u32(buffer, type);
+    EMIT(buffer, 0x48, 0xC7, 0x43, 0x08); // mov qword [rbx+8], bits
+    emit_u32(buffer, bits);
+    EMIT(buffer, 0x48, 0x83, 0xC3, 0x10); // add rbx, 16
+}
+
+static void emit_constant(CodeBuffer *buffer, Value *constant) {
+    EMIT(buffer, 0x48, 0xB8); // mov rax, constant
+    emit_u64(buffer, (u64)(uintptr_t)constant);
+    EMIT(buffer, 0x0F, 0x10, 0x00);       // movups xmm0, [rax]
+    EMIT(buffer, 0x0F, 0x11, 0x03);       // movups [rbx], xmm0
+    EMIT(buffer, 0x48, 0x83, 0xC3, 0x10); // add rbx, 16
+}
+
+// Pushes the global in slot, leaving undefined ones to the helper to report.
+// The values array moves when slots are added, so its address is loaded
+// every time rather than baked in.
+static void emit_get_global(CodeBuffer *buffer, u16 slot, size_t offset) {
+    EMIT(buffer, 0x48, 0xB8); // mov rax, &vm.globals.values
+    emit_u64(buffer, (u64)(uintptr_t)&vm.globals.values);
+    EMIT(buffer, 0x48, 0x8B, 0x00); // mov rax, [rax]
+    EMIT(buffer, 0x48, 0x05);       // add rax, slot * sizeof(Value)
+    emit_u32(buffer, (u32)(slot * sizeof(Value)));
+    EMIT(buffer, 0x83, 0x38, VAL_OBJ); // cmp dword [rax], VAL_OBJ
+    EMIT(buffer, 0x75, 11);            // jne over the NULL check
+    EMIT(buffer, 0x48, 0x83, 0x78, 0x08, 0x00); // cmp qword [rax+8], 0
+    size_t undefined = emit_jump(buffer, JE, sizeof(JE));
+    EMIT(buffer, 0x0F, 0x10, 0x00);       // movups xmm0, [rax]
+    EMIT(buffer, 0x0F, 0x11, 0x03);       // movups [rbx], xmm0
+    EMIT(buffer, 0x48, 0x83, 0xC3, 0x10); // add rbx, 16
+    size_t done = emit_jump(buffer, JMP, sizeof(JMP));
+    patch_jump(buffer, undefined);
+    emit_helper_call(buffer, OP_GET_GLOBAL, offset);
+    patch_jump(buffer, done);
+}
+
+static bool translate(CodeBuffer *buffer, Chunk *chunk) {
+    EMIT(buffer, 0x53, 0x41, 0x54, 0x41, 0x55); // push rbx; push r12; push r13
+    EMIT(buffer, 0x49, 0xBC);                   // mov r12, &vm.stack_top
+    emit_u64(buffer, (u64)(uintptr_t)&vm.stack_top);
+    EMIT(buffer, 0x49, 0x8B, 0x1C, 0x24); // mov rbx, [r12]
+
+    for (size_t offset = 0; offset < chunk->count;) {
+        u8 instruction = chunk->code[offset];
+        switch (instruction) {
+        case OP_CONSTANT:
+            emit_constant(buffer,
+                          &chunk->constants.items[chunk->code[offset + 1]]);
+            offset += 2;
+            continue;
+        case OP_GET_GLOBAL:
+            emit_get_global(buffer,
+                            read_slot_operand(&chunk->code[offset + 1]),
+                            offset);
+            offset += 3;
+            continue;
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+            emit_helper_call(buffer, instruction, offset);
+            offset += 3;
+            continue;
+        case OP_POP: EMIT(buffer, 0x48, 0x83, 0xEB, 0x10); break; // sub rbx, 16
+        case OP_NIL  : emit_push_literal(buffer, VAL_NIL, 0); break;
+        case OP_TRUE : emit_push_literal(buffer, VAL_BOOL, 1); break;
+        case OP_FALSE: emit_push_literal(buffer, VAL_BOOL, 0); break;
+        case OP_NOT  : emit_helper_call(buffer, OP_NOT, offset); break;
+        case OP_EQUAL:
+        case OP_NEGATE: emit_guarded(buffer, instruction, offset); break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:
+        case OP_GREATER_INT: emit_guarded(buffer, OP_GREATER, offset); break;
+        case OP_LESS:
+        case OP_LESS_NUM:
+        case OP_LESS_INT: emit_guarded(buffer, OP_LESS, offset); break;
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_INT:
+        case OP_ADD_STR: emit_guarded(buffer, OP_ADD, offset); break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+        case OP_SUBTRACT_INT: emit_guarded(buffer, OP_SUBTRACT, offset); break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+        case OP_MULTIPLY_INT: emit_guarded(buffer, OP_MULTIPLY, offset); break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+        case OP_DIVIDE_INT: emit_guarded(buffer, OP_DIVIDE, offset); break;
+        case OP_RETURN:
+            emit_helper_call(buffer, OP_RETURN, offset);
+            EMIT(buffer, 0x31, 0xC0); // xor eax, eax
+            emit_epilogue(buffer);
+            return true;
+        default: return false;
+        }
+        offset++;
+    }
+    return false;
+}
+
+// Everything the generated code doesn't handle inline: mixed or
+// overflowing numbers, string concatenation, equality of non-numbers,
+// assigning globals, and reporting errors
+static InterpretResult jit_helper(u32 op, u32 offset) {
+    vm.ip = vm.chunk->code + offset + 1;
+    Value *top = vm.stack_top;
+
+    switch (op) {
+    case OP_NEGATE:
+        if (!IS_NUMERIC(top[-1])) break;
+        top[-1] = number_negate(top[-1]);
+        return INTERPRET_OK;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_GREATER:
+    case OP_LESS:
+        if (!IS_NUMERIC(top[-1]) || !IS_NUMERIC(top[-2])) break;
+        top[-2] = number_binary((OpCode)op, top[-2], top[-1]);
+        vm.stack_top--;
+        return INTERPRET_OK;
+    }
+
+    switch (op) {
+    case OP_ADD:
+        if (IS_STRING(top[-1]) && IS_STRING(top[-2])) {
+            top[-2] = OBJ_VAL(
+                (Obj *)concat_str(AS_STRING(top[-2]), AS_STRING(top[-1])));
+            vm.stack_top--;
+            return INTERPRET_OK;
+        }
+        if (IS_ARRAY(top[-1]) || IS_ARRAY(top[-2])) break;
+        vm_error("Operands must be two numbers or two strings.");
+        return INTERPRET_RUNTIME_ERROR;
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_GREATER:
+    case OP_LESS:
+        if (IS_ARRAY(top[-1]) || IS_ARRAY(top[-2])) break;
+        vm_error("Operands must be numbers.");
+        return INTERPRET_RUNTIME_ERROR;
+    case OP_NEGATE:
+        if (IS_ARRAY(top[-1])) {
+            top[-1] = array_unary(OP_NEGATE, AS_ARRAY(top[-1]));
+            return INTERPRET_OK;
+        }
+        vm_error("Operand must be an a number.");
+        return INTERPRET_RUNTIME_ERROR;
+    case OP_EQUAL:
+        top[-2] = BOOL_VAL(values_equal(top[-2], top[-1]));
+        vm.stack_top--;
+        return INTERPRET_OK;
+    case OP_NOT:
+        top[-1] = IS_ARRAY(top[-1]) ? array_unary(OP_NOT, AS_ARRAY(top[-1]))
+                                    : BOOL_VAL(is_falsey(top[-1]));
+        return INTERPRET_OK;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+        u16 slot = read_slot_operand(vm.ip);
+        if (IS_UNDEFINED(vm.globals.values[slot])) {
+            undefined_variable(slot);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        if (op == OP_SET_GLOBAL) {
+            vm.globals.values[slot] = top[-1];
+            return INTERPRET_OK;
+        }
+        *top = vm.globals.values[slot];
+        vm.stack_top++;
+        return INTERPRET_OK;
+    }
+    case OP_DEFINE_GLOBAL:
+        vm.globals.values[read_slot_operand(vm.ip)] = top[-1];
+        return INTERPRET_OK;
+    case OP_RETURN: vm.result = *--vm.stack_top; return INTERPRET_OK;
+    default       : return INTERPRET_RUNTIME_ERROR;
+    }
+
+    // Arithmetic and comparisons with an array operand
+    if (!array_binary((OpCode)op, top[-2], top[-1], &top[-2])) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    vm.stack_top--;
+    return INTERPRET_OK;
+}
+
+// Lets perf symbolize samples in generated code, see
+// tools/perf/Documentation/jit-interface.txt in the kernel sources
+static void write_perf_map(JitCode *jit) {
+    static FILE *map = NULL;
+    static u64 chunks = 0;
+
+    if (map == NULL) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        map = fopen(path, "a");
+        if (map == NULL) return;
+    }
+    fprintf(map, "%lx %zx clox_chunk_%llu\n", (unsigned long)jit->code,
+            jit->size, (unsigned long long)chunks++);
+    fflush(map);
+}
+
+// Translates chunk into native code, returning NULL if it contains an
+// instruction without a template
+JitCode *jit_compile(Chunk *chunk) {
+    CodeBuffer buffer = {0, 0, NULL};
+    if (!translate(&buffer, chunk)) {
+        FREE_ARRAY(u8, buffer.code, buffer.alloc);
+        return NULL;
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (buffer.count + page - 1) / page * page;
+    void *code = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        FREE_ARRAY(u8, buffer.code, buffer.alloc);
+        return NULL;
+    }
+    memcpy(code, buffer.code, buffer.count);
+    FREE_ARRAY(u8, buffer.code, buffer.alloc);
+    if (mprotect(code, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, mapped);
+        return NULL;
+    }
+
+    JitCode *jit = ALLOCATE(JitCode, 1);
+    jit->code = code;
+    jit->size = buffer.count;
+    jit->mapped = mapped;
+    if (vm.jit_perf_map) write_perf_map(jit);
+    return jit;
+}
+
+InterpretResult jit_run(JitCode *jit) {
+    InterpretResult (*function)(void);
+    memcpy(&function, &jit->code, sizeof(function));
+    return function();
+}
+
+void free_jit(JitCode *jit) {
+    if (jit == NULL) return;
+    munmap(jit->code, jit->mapped);
+    FREE(JitCode, jit);
+}
+
+#else
+
+// Other architectures keep running everything on the interpreter
+
+JitCode *jit_compile(Chunk *chunk) {
+    (void)chunk;
+    return NULL;
+}
+
+InterpretResult jit_run(JitCode *jit) {
+    (void)jit;
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+void free_jit(JitCode *jit) { (void)jit; }
+
+#endif
@@ -1,8 +1,20 @@
+#include "batch.h"
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "heap.h"
+#include "recorder.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "stack.h"
+#include "stream.h"
 #include "vm.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+extern VM vm;
+
 static void repl(void) {
     char line[1024];
     while (true) {
@@ -38,28 +50,194 @@ static char *read_file(const char *path) {
     return buf;
 }
 
-static void run_file(const char *path) {
+// Files are read once and kept until the VM goes, so their strings are
+// borrowed rather than copied
+static int run_file(const char *path) {
     char *source = read_file(path);
+    pin_source(source, strlen(source), true);
     InterpretResult result = interpret(source);
-    free(source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+// Runs every line of the file at path as a task of its own, interleaving
+// them quantum instructions at a time, and prints each result as its task
+// finishes, prefixed with its line number
+static int run_tasks(const char *path, u64 quantum) {
+    char *source = read_file(path);
+    pin_source(source, strlen(source), true);
+    Scheduler scheduler;
+    init_scheduler(&scheduler, quantum);
+
+    int status = 0;
+    size_t line = 1;
+    for (char *start = source; *start != '\0'; line++) {
+        char *end = strchr(start, '\n');
+        char *next = end == NULL ? start + strlen(start) : end + 1;
+        if (end != NULL) *end = '\0';
+        if (*start != '\0' && spawn_task(&scheduler, line, start) == NULL) {
+            write_fmt(&vm.out, "%zu: error\n", line);
+            status = 65;
+        }
+        start = next;
+    }
+
+    while (scheduler.count > 0) {
+        Task *task = run_slice(&scheduler);
+        if (task == NULL) continue;
+
+        write_fmt(&vm.out, "%zu: ", task->id);
+        if (task->status == INTERPRET_OK) {
+            print_Value(task->result);
+        } else {
+            write_cstr(&vm.out, "error");
+            status = 70;
+        }
+        write_char(&vm.out, '\n');
+        free_task(task);
+    }
+
+    free_scheduler(&scheduler);
+    flush_writer(&vm.out);
+    return status;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: clox [options] [path]\n"
+                    "       clox [options] --eval-stream [path]\n"
+                    "       clox [options] --schedule QUANTUM path\n"
+                    "       clox [options] --batch EXPR [path]\n"
+                    "Options:\n"
+                    "  --cache-budget BYTES  memory for cached chunks, 0 "
+                    "disables the cache\n"
+                    "  --register            run on the register machine\n"
+                    "  --jit RUNS            compile chunks to native code "
+                    "after RUNS runs\n"
+                    "  --jit-perf-map        describe native code in "
+                    "/tmp/perf-PID.map\n"
+                    "  --pipeline BYTES      scan sources of at least BYTES "
+                    "on their own thread\n"
+                    "  --stats               print runtime counters on exit\n"
+                    "  --heap-dump PATH      write a JSON census of the heap "
+                    "to PATH on exit\n"
+                    "  --snapshot-in PATH    start from the strings and "
+                    "chunks saved in PATH\n"
+                    "  --snapshot-out PATH   save strings and cached chunks "
+                    "to PATH on exit\n"
+                    "  --flight-recorder PATH  append the last instructions "
+                    "run to PATH on\n"
+                    "                        runtime errors, - for stderr\n");
+    exit(64);
+}
+
+static size_t parse_size(const char *arg) {
+    char *end;
+    unsigned long long size = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0') usage();
+    return (size_t)size;
+}
+
+static void print_stats(void) {
+    print_cache_stats(&vm.cache, stderr);
+    print_vm_stats(stderr);
+    print_slab_stats(&vm.slab, stderr);
+}
+
+static void write_heap_dump(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return;
+    }
+    dump_heap(file);
+    fclose(file);
+}
+
+// Where runtime errors dump the flight recorder, crashes dump it to
+// stderr without one
+static int open_recorder_dump(const char *path) {
+    if (strcmp(path, "-") == 0) return STDERR_FILENO;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    return fd;
 }
 
 int main(int argc, const char *argv[]) {
     init_VM();
+    install_recorder_handlers();
+    install_stack_guard();
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
+    const char *path = NULL, *heap_dump = NULL;
+    const char *snapshot_in = NULL, *snapshot_out = NULL, *batch = NULL;
+    bool stream = false, stats = false, schedule = false;
+    u64 quantum = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--eval-stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch = argv[++i];
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            schedule = true;
+            quantum = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--register") == 0) {
+            vm.backend = BACKEND_REGISTER;
+        } else if (strcmp(argv[i], "--jit") == 0 && i + 1 < argc) {
+            vm.jit_threshold = (u32)parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--jit-perf-map") == 0) {
+            vm.jit_perf_map = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+            vm.pipeline_threshold = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--heap-dump") == 0 && i + 1 < argc) {
+            heap_dump = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-in") == 0 && i + 1 < argc) {
+            snapshot_in = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-out") == 0 && i + 1 < argc) {
+            snapshot_out = argv[++i];
+        } else if (strcmp(argv[i], "--flight-recorder") == 0 &&
+                   i + 1 < argc) {
+            vm.recorder.fd = open_recorder_dump(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--cache-budget") == 0 && i + 1 < argc) {
+            set_cache_budget(&vm.cache, parse_size(argv[++i]));
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+
+    // Loaded once every option is in, so that the cached chunks in the
+    // snapshot are held to the budget this run was given
+    if (snapshot_in != NULL && !load_snapshot(snapshot_in)) {
+        free_VM();
+        return 74;
+    }
+
+    int status = 0;
+    if (stream) {
+        status = eval_stream(path);
+    } else if (batch != NULL) {
+        status = eval_batch(batch, path);
+    } else if (schedule) {
+        if (path == NULL) usage();
+        status = run_tasks(path, quantum);
+    } else if (path != NULL) {
+        status = run_file(path);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        repl();
     }
 
+    if (stats) print_stats();
+    if (heap_dump != NULL) write_heap_dump(heap_dump);
+    if (snapshot_out != NULL && !write_snapshot(snapshot_out)) status = 74;
+    if (vm.recorder.fd > STDERR_FILENO) close(vm.recorder.fd);
     free_VM();
 
-    return 0;
+    return status;
 }
@@ -1,24 +1,43 @@
 #include "memory.h"
 #include "common.h"
+#include "probes.h"
+#include "slab.h"
 #include "vm.h"
 
 extern VM vm;
 
 void *reallocate(void *pointer, size_t new_size) {
-    if (new_size == 0) return NULL;
+    PROBE2(reallocate, pointer, new_size);
+    if (new_size == 0) {
+        free(pointer);
+        return NULL;
+    }
 
     void *result = realloc(pointer, new_size);
     if (result == NULL) exit(1);
     return result;
 }
 
+void *allocate_small(size_t size) { return slab_alloc(&vm.slab, size); }
+
+void free_small(void *pointer, size_t size) {
+    slab_free(&vm.slab, pointer, size);
+}
+
+// Only frees what didn't come from the slab, the slab's pages are released
+// in bulk afterwards
 static void free_object(Obj *object) {
     ObjString *str;
     switch (object->type) {
     case OBJ_STRING:
         str = (ObjString *)object;
-        FREE_ARRAY(char, str->chars, str->length + 1);
-        FREE(ObjString, object);
+        if (!str->borrowed && str->length + 1 > SLAB_MAX) {
+            FREE_ARRAY(char, str->chars, str->length + 1);
+        }
+        break;
+    case OBJ_ARRAY:
+        // Aligned buffers come from aligned_alloc(), not reallocate()
+        free(((ObjArray *)object)->items);
         break;
     }
 }
@@ -0,0 +1,226 @@
+#include "native.h"
+#include "common.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "simd.h"
+#include "value.h"
+
+#include <math.h>
+
+// Applies a function from <math.h> to a number of either kind
+static const char *math_native(double (*function)(double), Value x,
+                               Value *result, const char *error) {
+    if (!IS_NUMERIC(x)) return error;
+    *result = NUMBER_VAL(function(as_double(x)));
+    return NULL;
+}
+
+static const char *sqrt_native(const Value *args, Value *result) {
+    return math_native(sqrt, args[0], result,
+                       "Argument to sqrt() must be a number.");
+}
+
+static const char *log_native(const Value *args, Value *result) {
+    return math_native(log, args[0], result,
+                       "Argument to log() must be a number.");
+}
+
+// Integers are already whole, so they are left as they are
+static const char *floor_native(const Value *args, Value *result) {
+    if (IS_INT(args[0])) {
+        *result = args[0];
+        return NULL;
+    }
+    return math_native(floor, args[0], result,
+                       "Argument to floor() must be a number.");
+}
+
+static const char *ceil_native(const Value *args, Value *result) {
+    if (IS_INT(args[0])) {
+        *result = args[0];
+        return NULL;
+    }
+    return math_native(ceil, args[0], result,
+                       "Argument to ceil() must be a number.");
+}
+
+static const char *abs_native(const Value *args, Value *result) {
+    if (IS_INT(args[0])) {
+        *result = AS_INT(args[0]) < 0 ? int_negate(AS_INT(args[0])) : args[0];
+        return NULL;
+    }
+    return math_native(fabs, args[0], result,
+                       "Argument to abs() must be a number.");
+}
+
+// Exact while an integer raised to a whole power fits in 64 bits
+static const char *pow_native(const Value *args, Value *result) {
+    if (!IS_NUMERIC(args[0]) || !IS_NUMERIC(args[1])) {
+        return "Arguments to pow() must be numbers.";
+    }
+    if (IS_INT(args[0]) && IS_INT(args[1]) && AS_INT(args[1]) >= 0) {
+        i64 base = AS_INT(args[0]), power = 1;
+        bool overflow = false;
+        for (i64 exponent = AS_INT(args[1]); exponent > 0 && !overflow;
+             exponent >>= 1) {
+            if (exponent & 1) {
+                overflow = __builtin_mul_overflow(power, base, &power);
+            }
+            if (exponent > 1 && !overflow) {
+                overflow = __builtin_mul_overflow(base, base, &base);
+            }
+        }
+        if (!overflow) {
+            *result = INT_VAL(power);
+            return NULL;
+        }
+    }
+    *result = NUMBER_VAL(pow(as_double(args[0]), as_double(args[1])));
+    return NULL;
+}
+
+// The smaller or larger of two numbers, which keeps its kind
+static const char *min_native(const Value *args, Value *result) {
+    if (!IS_NUMERIC(args[0]) || !IS_NUMERIC(args[1])) {
+        return "Arguments to min() must be numbers.";
+    }
+    *result = AS_BOOL(number_binary(OP_LESS, args[1], args[0])) ? args[1]
+                                                                  : args[0];
+    return NULL;
+}
+
+static const char *max_native(const Value *args, Value *result) {
+    if (!IS_NUMERIC(args[0]) || !IS_NUMERIC(args[1])) {
+        return "Arguments to max() must be numbers.";
+    }
+    *result = AS_BOOL(number_binary(OP_GREATER, args[1], args[0])) ? args[1]
+                                                                     : args[0];
+    return NULL;
+}
+
+static const char *len_native(const Value *args, Value *result) {
+    if (IS_STRING(args[0])) {
+        *result = INT_VAL((i64)AS_STRING(args[0])->length);
+    } else if (IS_ARRAY(args[0])) {
+        *result = INT_VAL((i64)AS_ARRAY(args[0])->length);
+    } else {
+        return "Argument to len() must be a string or an array.";
+    }
+    return NULL;
+}
+
+static const char *sum_native(const Value *args, Value *result) {
+    if (!IS_ARRAY(args[0])) return "Argument to sum() must be an array.";
+    ObjArray *a = AS_ARRAY(args[0]);
+    *result = NUMBER_VAL(simd_sum(a->items, a->length));
+    return NULL;
+}
+
+static const char *array_min_native(const Value *args, Value *result) {
+    if (!IS_ARRAY(args[0])) return "Argument to min() must be an array.";
+    ObjArray *a = AS_ARRAY(args[0]);
+    if (a->length == 0) return "Can't take the min() of an empty array.";
+    *result = NUMBER_VAL(simd_min(a->items, a->length));
+    return NULL;
+}
+
+static const char *array_max_native(const Value *args, Value *result) {
+    if (!IS_ARRAY(args[0])) return "Argument to max() must be an array.";
+    ObjArray *a = AS_ARRAY(args[0]);
+    if (a->length == 0) return "Can't take the max() of an empty array.";
+    *result = NUMBER_VAL(simd_max(a->items, a->length));
+    return NULL;
+}
+
+static const char *dot_native(const Value *args, Value *result) {
+    if (!IS_ARRAY(args[0]) || !IS_ARRAY(args[1])) {
+        return "Arguments to dot() must be arrays.";
+    }
+    ObjArray *a = AS_ARRAY(args[0]), *b = AS_ARRAY(args[1]);
+    if (a->length != b->length) return "Arrays must have the same length.";
+    *result = NUMBER_VAL(simd_dot(a->items, b->items, a->length));
+    return NULL;
+}
+
+void init_natives(Natives *natives) {
+    natives->count = 0;
+    natives->alloc = 0;
+    natives->items = NULL;
+
+    define_native(natives, "sqrt", 1, sqrt_native);
+    define_native(natives, "log", 1, log_native);
+    define_native(natives, "floor", 1, floor_native);
+    define_native(natives, "ceil", 1, ceil_native);
+    define_native(natives, "abs", 1, abs_native);
+    define_native(natives, "pow", 2, pow_native);
+    define_native(natives, "min", 2, min_native);
+    define_native(natives, "max", 2, max_native);
+    define_native(natives, "len", 1, len_native);
+    define_native(natives, "sum", 1, sum_native);
+    define_native(natives, "min", 1, array_min_native);
+    define_native(natives, "max", 1, array_max_native);
+    define_native(natives, "dot", 2, dot_native);
+}
+
+void free_natives(Natives *natives) {
+    for (size_t i = 0; i < natives->count; i++) {
+        FREE_ARRAY(char, natives->items[i].name, natives->items[i].length + 1);
+    }
+    FREE_ARRAY(Native, natives->items, natives->alloc);
+    natives->count = 0;
+    natives->alloc = 0;
+    natives->items = NULL;
+}
+
+bool define_native(Natives *natives, const char *name, u8 arity,
+                   NativeFn function) {
+    size_t length = strlen(name);
+    bool named;
+    i32 index = find_native(natives, name, length, arity, &named);
+    if (index >= 0) {
+        natives->items[index].function = function;
+        return true;
+    }
+    if (natives->count == NATIVES_MAX) return false;
+
+    if (natives->alloc < natives->count + 1) {
+        size_t old_alloc = natives->alloc;
+        natives->alloc = GROW_CAPACITY(old_alloc);
+        natives->items =
+            GROW_ARRAY(Native, natives->items, old_alloc, natives->alloc);
+    }
+    Native *native = &natives->items[natives->count++];
+    native->name = ALLOCATE(char, length + 1);
+    memcpy(native->name, name, length + 1);
+    native->length = length;
+    native->arity = arity;
+    native->function = function;
+    return true;
+}
+
+i32 find_native(Natives *natives, const char *name, size_t length, int arity,
+                bool *named) {
+    *named = false;
+    for (size_t i = 0; i < natives->count; i++) {
+        Native *native = &natives->items[i];
+        if (native->length != length ||
+            memcmp(native->name, name, length) != 0) {
+            continue;
+        }
+        if (native->arity == arity) return (i32)i;
+        *named = true;
+    }
+    return -1;
+}
+
+u64 natives_fingerprint(Natives *natives) {
+    u64 fingerprint = natives->count;
+    for (size_t i = 0; i < natives->count; i++) {
+        Native *native = &natives->items[i];
+        fingerprint = fingerprint * 0x100000001B3u ^
+                      hash_string(native->name, native->length) ^
+                      (u64)native->arity << 32;
+    }
+    return fingerprint;
+}
@@ -1,6 +1,9 @@
 #include "object.h"
 #include "common.h"
+#include "intern.h"
 #include "memory.h"
+#include "probes.h"
+#include "simd.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -11,58 +14,159 @@ extern VM vm;
     (type *)allocate_obj(sizeof(type), object_type)
 
 static Obj *allocate_obj(size_t size, ObjType type) {
-    Obj *obj = (Obj *)reallocate(NULL, size);
+    Obj *obj = (Obj *)allocate_small(size);
     obj->type = type;
+    PROBE3(allocate_obj, obj, type, size);
 
-    obj->next = vm.objects;
-    vm.objects = obj;
+    // Other threads may be pushing their own objects at the same time
+    obj->next = atomic_load_explicit(&vm.objects, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&vm.objects, &obj->next, obj,
+                                                  memory_order_release,
+                                                  memory_order_relaxed)) {}
     return obj;
 }
 
-static ObjString *allocate_string(char *chars, size_t length, u32 hash) {
+static ObjString *allocate_string(char *chars, size_t length, u32 hash,
+                                  bool interned) {
     ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
-    table_set(&vm.strings, string, NIL_VAL);
+    string->interned = interned;
+    string->borrowed = false;
     return string;
 }
 
-static u32 hash_string(const char *key, int length) {
-    u32 hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
+u32 hash_string(const char *key, size_t length) {
+    return hash_continue(2166136261u, key, length);
+}
+
+// FNV-1a has no finalization step, so the hash of a string can be carried on
+// over more bytes as if they had been part of it all along
+u32 hash_continue(u32 hash, const char *key, size_t length) {
+    for (size_t i = 0; i < length; i++) {
         hash ^= (u8)key[i];
         hash *= 16777619;
     }
     return hash;
 }
 
-ObjString *take_str(char *chars, size_t length) {
-    u32 hash = hash_string(chars, length);
-    ObjString *interned = table_find_string(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
+// Interning looks for an equal string and adds a new one while holding the
+// same shard's lock, so that equal strings interned on different threads
+// always come out as the same object
+static InternShard *lock_shard(u32 hash) {
+    InternShard *shard = intern_shard(&vm.strings, hash);
+    pthread_mutex_lock(&shard->lock);
+    return shard;
+}
 
-    return allocate_string(chars, length, hash);
+static ObjString *add_interned(InternShard *shard, ObjString *string) {
+    intern_set_add(&shard->set, string);
+    pthread_mutex_unlock(&shard->lock);
+    return string;
 }
 
 ObjString *copy_str(const char *chars, size_t length) {
     u32 hash = hash_string(chars, length);
+    InternShard *shard = lock_shard(hash);
 
     // If the same string has already been created, just return it
-    ObjString *interned = table_find_string(&vm.strings, chars, length, hash);
-    if (interned != NULL) return interned;
+    ObjString *interned = intern_set_find(&shard->set, chars, length, hash);
+    if (interned != NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        PROBE2(intern_hit, chars, length);
+        return interned;
+    }
 
-    char *heap_chars = ALLOCATE(char, length + 1);
+    PROBE2(intern_miss, chars, length);
+    char *heap_chars = ALLOCATE_SMALL(char, length + 1);
     memcpy(heap_chars, chars, length);
     heap_chars[length] = '\0';
-    return allocate_string(heap_chars, length, hash);
+    return add_interned(shard,
+                        allocate_string(heap_chars, length, hash, true));
+}
+
+// Same as copy_str(), but a new string points at chars instead of copying
+// them, so they must stay alive and unchanged until free_VM()
+ObjString *borrow_str(const char *chars, size_t length) {
+    u32 hash = hash_string(chars, length);
+    InternShard *shard = lock_shard(hash);
+    ObjString *interned = intern_set_find(&shard->set, chars, length, hash);
+    if (interned != NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        PROBE2(intern_hit, chars, length);
+        return interned;
+    }
+
+    PROBE2(intern_miss, chars, length);
+    ObjString *string = allocate_string((char *)chars, length, hash, true);
+    string->borrowed = true;
+    return add_interned(shard, string);
+}
+
+// The result is not interned, most of them are only ever printed
+ObjString *concat_str(ObjString *a, ObjString *b) {
+    size_t length = a->length + b->length;
+    char *chars = ALLOCATE_SMALL(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+
+    u32 hash = hash_continue(a->hash, b->chars, b->length);
+    return allocate_string(chars, length, hash, false);
+}
+
+bool str_equal(ObjString *a, ObjString *b) {
+    if (a == b) return true;
+    // Two interned strings are only equal if they are the same object
+    if (a->interned && b->interned) return false;
+    return a->length == b->length && a->hash == b->hash &&
+           memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// The elements are left uninitialized, the padding after them is zeroed
+ObjArray *new_array(size_t length) {
+    size_t padded = (length + SIMD_LANES - 1) / SIMD_LANES * SIMD_LANES;
+    if (padded == 0) padded = SIMD_LANES;
+    double *items = aligned_alloc(SIMD_ALIGNMENT, padded * sizeof(double));
+    if (items == NULL) exit(1);
+    memset(items + length, 0, (padded - length) * sizeof(double));
+
+    ObjArray *array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->length = length;
+    array->padded = padded;
+    array->items = items;
+    return array;
+}
+
+ObjArray *copy_array(const double *items, size_t length) {
+    ObjArray *array = new_array(length);
+    if (length > 0) memcpy(array->items, items, length * sizeof(double));
+    return array;
+}
+
+bool array_equal(ObjArray *a, ObjArray *b) {
+    if (a->length != b->length) return false;
+    for (size_t i = 0; i < a->length; i++) {
+        if (a->items[i] != b->items[i]) return false;
+    }
+    return true;
+}
+
+static void print_array(ObjArray *array) {
+    write_char(&vm.out, '[');
+    for (size_t i = 0; i < array->length; i++) {
+        if (i > 0) write_bytes(&vm.out, ", ", 2);
+        write_number(&vm.out, array->items[i]);
+    }
+    write_char(&vm.out, ']');
 }
 
 void print_obj(Value value) {
     switch (TYPEOF_OBJ(value)) {
-    case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+    case OBJ_STRING:
+        write_bytes(&vm.out, AS_CSTRING(value), AS_STRING(value)->length);
+        break;
+    case OBJ_ARRAY: print_array(AS_ARRAY(value)); break;
     }
 }
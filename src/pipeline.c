@@ -0,0 +1,68 @@
+#include "pipeline.h"
+#include "common.h"
+#include "scanner.h"
+#include <sched.h>
+
+static void *scan_tokens(void *arg) {
+    TokenRing *ring = arg;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    while (true) {
+        Token token = scan_token();
+
+        // Wait for the parser to make room, unless it's no longer listening
+        while (head - tail == TOKEN_RING_SIZE) {
+            if (atomic_load_explicit(&ring->stop, memory_order_relaxed)) {
+                return NULL;
+            }
+            sched_yield();
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        }
+
+        ring->tokens[head & (TOKEN_RING_SIZE - 1)] = token;
+        head++;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        if (token.type == TOKEN_EOF) return NULL;
+    }
+}
+
+// Scans source on a new thread. The scanner's state belongs to that thread
+// until stop_pipeline() returns.
+TokenRing *start_pipeline(const char *source) {
+    TokenRing *ring = aligned_alloc(CACHE_LINE, sizeof(TokenRing));
+    if (ring == NULL) exit(1);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->stop, false);
+    ring->at_eof = false;
+    init_scanner(source);
+    if (pthread_create(&ring->thread, NULL, scan_tokens, ring) != 0) exit(1);
+    return ring;
+}
+
+// Tokens come out in the order they were scanned, errors included
+Token next_token(TokenRing *ring) {
+    if (ring->at_eof) return ring->eof;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        sched_yield();
+    }
+
+    Token token = ring->tokens[tail & (TOKEN_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    if (token.type == TOKEN_EOF) {
+        ring->at_eof = true;
+        ring->eof = token;
+    }
+    return token;
+}
+
+// Waits for the scanner thread to finish, which it does right away if the
+// parser stopped before reading all of the tokens, and frees the ring
+void stop_pipeline(TokenRing *ring) {
+    atomic_store_explicit(&ring->stop, true, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    free(ring);
+}
@@ -0,0 +1,239 @@
+#include "recorder.h"
+#include "array.h"
+#include "common.h"
+#include "debug.h"
+#include "object.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+
+extern VM vm;
+
+// Dumps are put together in a fixed buffer and written a line at a time,
+// since nothing that allocates or takes a lock may run in a signal handler
+typedef struct {
+    size_t length;
+    char chars[160];
+} Text;
+
+static void put_str(Text *text, const char *chars) {
+    while (*chars != '\0' && text->length < sizeof(text->chars)) {
+        text->chars[text->length++] = *chars++;
+    }
+}
+
+static void put_u64(Text *text, u64 value) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (count > 0 && text->length < sizeof(text->chars)) {
+        text->chars[text->length++] = digits[--count];
+    }
+}
+
+static void put_i64(Text *text, i64 value) {
+    if (value < 0) put_str(text, "-");
+    put_u64(text, value < 0 ? -(u64)value : (u64)value);
+}
+
+// Six decimals at most, with an exponent once the integer part no longer
+// fits in 64 bits. Enough to tell values apart, which is all a dump needs.
+static void put_double(Text *text, double value) {
+    if (isnan(value)) {
+        put_str(text, "nan");
+        return;
+    }
+    if (signbit(value)) put_str(text, "-");
+    value = fabs(value);
+    if (isinf(value)) {
+        put_str(text, "inf");
+        return;
+    }
+    u64 exponent = 0;
+    while (value >= 1e18) {
+        value /= 10;
+        exponent++;
+    }
+    u64 whole = (u64)value;
+    u64 fraction = (u64)((value - (double)whole) * 1e6 + 0.5);
+    if (fraction == 1000000) {
+        whole++;
+        fraction = 0;
+    }
+    put_u64(text, whole);
+    if (fraction != 0) {
+        char digits[8] = ".000000";
+        int end = 7;
+        for (int i = 6; i > 0; i--, fraction /= 10) {
+            digits[i] = (char)('0' + fraction % 10);
+        }
+        while (digits[end - 1] == '0') end--;
+        digits[end] = '\0';
+        put_str(text, digits);
+    }
+    if (exponent != 0) {
+        put_str(text, "e");
+        put_u64(text, exponent);
+    }
+}
+
+// Objects are only described, their contents could be anything
+static void put_value(Text *text, Value value) {
+    switch (value.type) {
+    case VAL_NIL   : put_str(text, "nil"); break;
+    case VAL_BOOL  : put_str(text, AS_BOOL(value) ? "true" : "false"); break;
+    case VAL_NUMBER: put_double(text, AS_NUMBER(value)); break;
+    case VAL_INT   : put_i64(text, AS_INT(value)); break;
+    case VAL_OBJ:
+        if (IS_STRING(value)) {
+            put_str(text, "<string of ");
+            put_u64(text, AS_STRING(value)->length);
+            put_str(text, " chars>");
+        } else if (IS_ARRAY(value)) {
+            put_str(text, "<array of ");
+            put_u64(text, AS_ARRAY(value)->length);
+            put_str(text, " numbers>");
+        } else {
+            put_str(text, "<object>");
+        }
+        break;
+    }
+}
+
+// Pads with spaces up to column, and with at least one past it, so that a
+// field that overflows its column is still kept apart from the next one
+static void pad_to(Text *text, size_t column) {
+    do {
+        if (text->length == sizeof(text->chars)) return;
+        text->chars[text->length++] = ' ';
+    } while (text->length < column);
+}
+
+static void write_text(int fd, Text *text) {
+    for (size_t written = 0; written < text->length;) {
+        ssize_t result =
+            write(fd, text->chars + written, text->length - written);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) break;
+        written += (size_t)result;
+    }
+    text->length = 0;
+}
+
+void init_recorder(Recorder *recorder) {
+    recorder->count = 0;
+    recorder->fd = -1;
+}
+
+void dump_recorder(Recorder *recorder, int fd, const char *reason) {
+    // Errors may be reported from inside a signal handler, leave errno as
+    // the interrupted code had it
+    int saved_errno = errno;
+    u64 count = recorder->count;
+    u64 kept = count < RECORDER_SIZE ? count : RECORDER_SIZE;
+
+    Text text = {0, {0}};
+    put_str(&text, "== flight recorder: ");
+    put_str(&text, reason);
+    put_str(&text, ", last ");
+    put_u64(&text, kept);
+    put_str(&text, " of ");
+    put_u64(&text, count);
+    put_str(&text, " instructions ==\n");
+    write_text(fd, &text);
+
+    for (u64 i = count - kept; i < count; i++) {
+        Record *entry = &recorder->records[i & (RECORDER_SIZE - 1)];
+        // Columns are wide enough for the largest index, offset, line and
+        // depth there can be, and the longest opcode name
+        put_u64(&text, i);
+        pad_to(&text, 21);
+        put_str(&text, "offset ");
+        put_u64(&text, entry->offset);
+        pad_to(&text, 39);
+        put_str(&text, "line ");
+        const Chunk *chunk = entry->chunk;
+        if (chunk != NULL && chunk == vm.chunk &&
+            entry->offset < chunk->count) {
+            put_u64(&text, get_line((Chunk *)chunk, entry->offset));
+        } else {
+            put_str(&text, "?");
+        }
+        pad_to(&text, 55);
+        put_str(&text, opcode_name(entry->op));
+        pad_to(&text, 73);
+        put_str(&text, "depth ");
+        put_u64(&text, entry->depth);
+        pad_to(&text, 90);
+        put_value(&text, entry->top);
+        put_str(&text, "\n");
+        write_text(fd, &text);
+    }
+    errno = saved_errno;
+}
+
+static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+#define FATAL_SIGNALS (sizeof(fatal_signals) / sizeof(fatal_signals[0]))
+static struct sigaction previous[FATAL_SIGNALS];
+
+static const char *signal_name(int signo) {
+    switch (signo) {
+    case SIGSEGV: return "SIGSEGV";
+    case SIGBUS : return "SIGBUS";
+    case SIGFPE : return "SIGFPE";
+    case SIGILL : return "SIGILL";
+    case SIGABRT: return "SIGABRT";
+    default     : return "SIGUSR1";
+    }
+}
+
+static void on_signal(int signo) {
+    int fd = vm.recorder.fd >= 0 ? vm.recorder.fd : STDERR_FILENO;
+    dump_recorder(&vm.recorder, fd, signal_name(signo));
+    if (signo == SIGUSR1) return;
+
+    // The signal stays blocked until this returns, at which point it is
+    // delivered again to the handler that was there before. A fault would
+    // also come back by itself when the instruction is retried.
+    for (size_t i = 0; i < FATAL_SIGNALS; i++) {
+        if (fatal_signals[i] == signo) sigaction(signo, &previous[i], NULL);
+    }
+    raise(signo);
+}
+
+// Big enough for a dump, which keeps its buffers on the stack
+#define SIGNAL_STACK_SIZE 65536
+
+// Gives the thread an alternate stack for signal handlers, unless it already
+// has one, so that a crash from running out of stack can still be dumped
+static void install_signal_stack(void) {
+    stack_t current;
+    if (sigaltstack(NULL, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+        return;
+    }
+    size_t size = SIGSTKSZ > SIGNAL_STACK_SIZE ? SIGSTKSZ : SIGNAL_STACK_SIZE;
+    stack_t stack = {.ss_sp = malloc(size), .ss_size = size, .ss_flags = 0};
+    if (stack.ss_sp != NULL) sigaltstack(&stack, NULL);
+}
+
+void install_recorder_handlers(void) {
+    install_signal_stack();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    // Runs on the alternate stack, so that a stack overflow can still be
+    // reported
+    action.sa_flags = SA_ONSTACK | SA_RESTART;
+    for (size_t i = 0; i < FATAL_SIGNALS; i++) {
+        sigaction(fatal_signals[i], &action, &previous[i]);
+    }
+    sigaction(SIGUSR1, &action, NULL);
+}
@@ -0,0 +1,201 @@
+#include "register.h"
+#include "chunk.h"
+#include "common.h"
+#include "globals.h"
+#include "memory.h"
+
+// Registers for the nil, true and false literals come right after the
+// constants
+#define REG_NIL(chunk) ((chunk)->constants.count)
+#define REG_TRUE(chunk) ((chunk)->constants.count + 1)
+#define REG_FALSE(chunk) ((chunk)->constants.count + 2)
+
+typedef struct {
+    Chunk *chunk;
+    RegChunk *out;
+    size_t alloc;
+    // Register holding each value that would be on the stack at this
+    // point in the stack code
+    u16 operands[UINT8_MAX + 1];
+    size_t depth;
+    size_t temps;
+} Translator;
+
+static void emit(Translator *t, u8 op, u16 a, u16 b, u16 c, size_t offset) {
+    RegChunk *out = t->out;
+    if (t->alloc < out->count + 1) {
+        size_t old_alloc = t->alloc;
+        t->alloc = GROW_CAPACITY(old_alloc);
+        out->code =
+            GROW_ARRAY(RegInstruction, out->code, old_alloc, t->alloc);
+        out->offsets = GROW_ARRAY(size_t, out->offsets, old_alloc, t->alloc);
+    }
+
+    RegInstruction *instruction = &out->code[out->count];
+    instruction->op = op;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+    out->offsets[out->count] = offset;
+    out->count++;
+}
+
+static bool push_operand(Translator *t, size_t reg) {
+    if (t->depth > UINT8_MAX || reg > UINT16_MAX) return false;
+    t->operands[t->depth++] = (u16)reg;
+    return true;
+}
+
+// Where the result of an instruction leaving depth values on the stack
+// goes. Every stack slot gets its own register after the literals.
+static size_t temp_register(Translator *t) {
+    if (t->depth + 1 > t->temps) t->temps = t->depth + 1;
+    return REG_FALSE(t->chunk) + 1 + t->depth;
+}
+
+static bool translate_unary(Translator *t, RegOpCode op, size_t offset) {
+    if (t->depth < 1) return false;
+    u16 b = t->operands[--t->depth];
+    size_t dest = temp_register(t);
+    if (dest > UINT16_MAX) return false;
+    emit(t, op, (u16)dest, b, 0, offset);
+    return push_operand(t, dest);
+}
+
+static bool translate_binary(Translator *t, RegOpCode op, size_t offset) {
+    if (t->depth < 2) return false;
+    u16 c = t->operands[--t->depth];
+    u16 b = t->operands[--t->depth];
+    size_t dest = temp_register(t);
+    if (dest > UINT16_MAX) return false;
+    emit(t, op, (u16)dest, b, c, offset);
+    return push_operand(t, dest);
+}
+
+static bool translate(Translator *t) {
+    Chunk *chunk = t->chunk;
+    for (size_t offset = 0; offset < chunk->count;) {
+        u8 instruction = chunk->code[offset];
+        bool ok;
+        switch (instruction) {
+        case OP_CONSTANT:
+            if (!push_operand(t, chunk->code[offset + 1])) return false;
+            offset += 2;
+            continue;
+        case OP_GET_GLOBAL: {
+            size_t dest = temp_register(t);
+            if (dest > UINT16_MAX) return false;
+            emit(t, ROP_GET_GLOBAL, (u16)dest,
+                 read_slot_operand(&chunk->code[offset + 1]), 0, offset);
+            if (!push_operand(t, dest)) return false;
+            offset += 3;
+            continue;
+        }
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+            // The value stays on the stack, in the register it was in
+            if (t->depth < 1) return false;
+            emit(t,
+                 instruction == OP_SET_GLOBAL ? ROP_SET_GLOBAL
+                                              : ROP_DEFINE_GLOBAL,
+                 read_slot_operand(&chunk->code[offset + 1]),
+                 t->operands[t->depth - 1], 0, offset);
+            offset += 3;
+            continue;
+        case OP_POP:
+            if (t->depth < 1) return false;
+            t->depth--;
+            ok = true;
+            break;
+        case OP_NIL     : ok = push_operand(t, REG_NIL(chunk)); break;
+        case OP_TRUE    : ok = push_operand(t, REG_TRUE(chunk)); break;
+        case OP_FALSE   : ok = push_operand(t, REG_FALSE(chunk)); break;
+        case OP_NOT     : ok = translate_unary(t, ROP_NOT, offset); break;
+        case OP_NEGATE  : ok = translate_unary(t, ROP_NEGATE, offset); break;
+        case OP_EQUAL   : ok = translate_binary(t, ROP_EQUAL, offset); break;
+        case OP_GREATER :
+        case OP_GREATER_NUM:
+        case OP_GREATER_INT:
+            ok = translate_binary(t, ROP_GREATER, offset);
+            break;
+        case OP_LESS:
+        case OP_LESS_NUM:
+        case OP_LESS_INT: ok = translate_binary(t, ROP_LESS, offset); break;
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_INT:
+        case OP_ADD_STR: ok = translate_binary(t, ROP_ADD, offset); break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+        case OP_SUBTRACT_INT:
+            ok = translate_binary(t, ROP_SUBTRACT, offset);
+            break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+        case OP_MULTIPLY_INT:
+            ok = translate_binary(t, ROP_MULTIPLY, offset);
+            break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+        case OP_DIVIDE_INT:
+            ok = translate_binary(t, ROP_DIVIDE, offset);
+            break;
+        case OP_RETURN:
+            if (t->depth < 1) return false;
+            emit(t, ROP_RETURN, t->operands[--t->depth], 0, 0, offset);
+            return true;
+        default: return false;
+        }
+        if (!ok) return false;
+        offset++;
+    }
+    // Chunks always end with OP_RETURN
+    return false;
+}
+
+// Translates the stack code in chunk into register code, returning NULL
+// if it uses something the register machine doesn't support
+RegChunk *compile_registers(Chunk *chunk) {
+    RegChunk *reg_chunk = ALLOCATE(RegChunk, 1);
+    reg_chunk->count = 0;
+    reg_chunk->code = NULL;
+    reg_chunk->offsets = NULL;
+    reg_chunk->register_count = 0;
+    reg_chunk->registers = NULL;
+
+    Translator t;
+    t.chunk = chunk;
+    t.out = reg_chunk;
+    t.alloc = 0;
+    t.depth = 0;
+    t.temps = 0;
+
+    if (!translate(&t)) {
+        FREE_ARRAY(RegInstruction, reg_chunk->code, t.alloc);
+        FREE_ARRAY(size_t, reg_chunk->offsets, t.alloc);
+        FREE(RegChunk, reg_chunk);
+        return NULL;
+    }
+
+    size_t literals = REG_FALSE(chunk) + 1;
+    reg_chunk->register_count = literals + t.temps;
+    reg_chunk->registers = ALLOCATE(Value, reg_chunk->register_count);
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        reg_chunk->registers[i] = chunk->constants.items[i];
+    }
+    reg_chunk->registers[REG_NIL(chunk)] = NIL_VAL;
+    reg_chunk->registers[REG_TRUE(chunk)] = BOOL_VAL(true);
+    reg_chunk->registers[REG_FALSE(chunk)] = BOOL_VAL(false);
+    for (size_t i = literals; i < reg_chunk->register_count; i++) {
+        reg_chunk->registers[i] = NIL_VAL;
+    }
+    return reg_chunk;
+}
+
+void free_reg_chunk(RegChunk *reg_chunk) {
+    if (reg_chunk == NULL) return;
+    FREE_ARRAY(RegInstruction, reg_chunk->code, reg_chunk->count);
+    FREE_ARRAY(size_t, reg_chunk->offsets, reg_chunk->count);
+    FREE_ARRAY(Value, reg_chunk->registers, reg_chunk->register_count);
+    FREE(RegChunk, reg_chunk);
+}
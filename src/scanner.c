@@ -1,5 +1,7 @@
 #include "scanner.h"
 
+#include <errno.h>
+
 Scanner scanner;
 
 void init_scanner(const char *source) {
@@ -14,6 +16,9 @@ static Token make_token(TokenType type) {
     token.start = scanner.start;
     token.length = (int)(scanner.current - scanner.start);
     token.line = scanner.line;
+    token.integral = false;
+    token.integer = 0;
+    token.number = 0;
     return token;
 }
 
@@ -23,6 +28,9 @@ static Token error_token(const char *msg) {
     token.start = msg;
     token.length = (int)strlen(msg);
     token.line = scanner.line;
+    token.integral = false;
+    token.integer = 0;
+    token.number = 0;
     return token;
 }
 
@@ -35,7 +43,7 @@ static bool is_alphanumeric(char c) {
 }
 
 static bool is_identifier_char(char c) {
-    return is_alphanumeric(c) || is_digit(c) || c == '-';
+    return is_alphanumeric(c) || is_digit(c);
 }
 
 static char peek(void) { return *scanner.current; }
@@ -96,12 +104,21 @@ static Token consume_string(void) {
 static Token consume_number(void) {
     while (is_digit(peek())) consume();
 
+    bool integral = true;
     if (peek() == '.' && is_digit(peek_next())) {
+        integral = false;
         consume();
         while (is_digit(peek())) consume();
     }
 
-    return make_token(TOKEN_NUMBER);
+    Token token = make_token(TOKEN_NUMBER);
+    if (integral) {
+        errno = 0;
+        token.integer = strtoll(token.start, NULL, 10);
+        token.integral = errno != ERANGE;
+    }
+    if (!token.integral) token.number = strtod(token.start, NULL);
+    return token;
 }
 
 static TokenType check_keyword(int start, int length, const char *rest,
@@ -127,7 +144,7 @@ static TokenType identifier_type(void) {
             }
         }
         break;
-    case 'i': return check_keyword(1, 1, "if", TOKEN_IF);
+    case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
     case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
     case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
     case 'p': return check_keyword(1, 4, "rint", TOKEN_PRINT);
@@ -145,7 +162,7 @@ static TokenType identifier_type(void) {
     case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
     }
 
-    return TOKEN_ERROR;
+    return TOKEN_IDENTIFIER;
 }
 
 static Token consume_identifier(void) {
@@ -169,6 +186,8 @@ Token scan_token(void) {
     case ')': return make_token(TOKEN_RIGHT_PAREN);
     case '{': return make_token(TOKEN_LEFT_BRACE);
     case '}': return make_token(TOKEN_RIGHT_BRACE);
+    case '[': return make_token(TOKEN_LEFT_BRACKET);
+    case ']': return make_token(TOKEN_RIGHT_BRACKET);
     case ';': return make_token(TOKEN_SEMICOLON);
     case ',': return make_token(TOKEN_COMMA);
     case '.': return make_token(TOKEN_DOT);
@@ -0,0 +1,129 @@
+#include "scheduler.h"
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+
+extern VM vm;
+
+void init_scheduler(Scheduler *scheduler, u64 quantum) {
+    scheduler->count = 0;
+    scheduler->alloc = 0;
+    scheduler->tasks = NULL;
+    scheduler->next = 0;
+    scheduler->quantum = quantum == 0 ? FUEL_UNLIMITED : quantum;
+}
+
+// Frees the tasks that haven't finished along with the scheduler
+void free_scheduler(Scheduler *scheduler) {
+    for (size_t i = 0; i < scheduler->count; i++) {
+        free_task(scheduler->tasks[i]);
+    }
+    FREE_ARRAY(Task *, scheduler->tasks, scheduler->alloc);
+    init_scheduler(scheduler, scheduler->quantum);
+}
+
+void free_task(Task *task) {
+    free_chunk(&task->chunk);
+    free_ValueArray(&task->stack);
+    free_ValueArray(&task->globals);
+    FREE(Task, task);
+}
+
+// Copies the values of every global slot there is, which includes every
+// slot the task's chunk refers to, since it has been compiled
+static void copy_globals(ValueArray *globals) {
+    size_t count = vm.globals.count;
+    if (count == 0) return;
+    globals->items = GROW_ARRAY(Value, globals->items, globals->alloc, count);
+    globals->alloc = count;
+    globals->count = count;
+    memcpy(globals->items, vm.globals.values, count * sizeof(Value));
+}
+
+// Compiles source into a new task at the back of the queue, returning NULL
+// if it has errors
+Task *spawn_task(Scheduler *scheduler, size_t id, const char *source) {
+    Task *task = ALLOCATE(Task, 1);
+    init_chunk(&task->chunk);
+    init_ValueArray(&task->stack);
+    init_ValueArray(&task->globals);
+    if (!compile(source, &task->chunk)) {
+        free_task(task);
+        return NULL;
+    }
+    copy_globals(&task->globals);
+    task->id = id;
+    task->ip = task->chunk.code;
+    task->status = INTERPRET_YIELD;
+    task->result = NIL_VAL;
+    task->slices = 0;
+
+    if (scheduler->alloc < scheduler->count + 1) {
+        size_t old_alloc = scheduler->alloc;
+        scheduler->alloc = GROW_CAPACITY(old_alloc);
+        scheduler->tasks = GROW_ARRAY(Task *, scheduler->tasks, old_alloc,
+                                      scheduler->alloc);
+    }
+    scheduler->tasks[scheduler->count++] = task;
+    return task;
+}
+
+// Copies what is on the VM's stack into saved, which only ever grows, so
+// that a task holds on to no more than the deepest stack it yielded with
+static void save_stack(ValueArray *saved) {
+    size_t count = (size_t)(vm.stack_top - vm.stack);
+    if (saved->alloc < count) {
+        saved->items = GROW_ARRAY(Value, saved->items, saved->alloc, count);
+        saved->alloc = count;
+    }
+    if (count != 0) memcpy(saved->items, vm.stack, count * sizeof(Value));
+    saved->count = count;
+}
+
+static void restore_stack(const ValueArray *saved) {
+    if (saved->count != 0) {
+        memcpy(vm.stack, saved->items, saved->count * sizeof(Value));
+    }
+    vm.stack_top = vm.stack + saved->count;
+}
+
+// Runs the next task in line for one quantum. Returns the task if that
+// finished it, in which case it leaves the queue and belongs to the
+// caller, or NULL if it still has more to run or there was nothing to run.
+Task *run_slice(Scheduler *scheduler) {
+    if (scheduler->count == 0) return NULL;
+    if (scheduler->next >= scheduler->count) scheduler->next = 0;
+    Task *task = scheduler->tasks[scheduler->next];
+
+    Chunk *chunk = vm.chunk;
+    Value *globals = vm.globals.values;
+    vm.chunk = &task->chunk;
+    vm.ip = task->ip;
+    restore_stack(&task->stack);
+    vm.globals.values = task->globals.items;
+    vm.fuel = scheduler->quantum;
+
+    task->status = resume();
+    task->slices++;
+
+    task->ip = vm.ip;
+    save_stack(&task->stack);
+    vm.fuel = FUEL_UNLIMITED;
+    vm.chunk = chunk;
+    vm.stack_top = vm.stack;
+    vm.globals.values = globals;
+
+    if (task->status == INTERPRET_YIELD) {
+        scheduler->next++;
+        return NULL;
+    }
+
+    if (task->status == INTERPRET_OK) task->result = vm.result;
+    scheduler->count--;
+    memmove(&scheduler->tasks[scheduler->next],
+            &scheduler->tasks[scheduler->next + 1],
+            (scheduler->count - scheduler->next) * sizeof(Task *));
+    return task;
+}
@@ -0,0 +1,223 @@
+#include "simd.h"
+#include "common.h"
+
+// Each kernel comes in an AVX2 and an SSE2 flavour, built from GCC vector
+// types in functions compiled for that instruction set, plus a plain C one
+// for other targets. The AVX2 ones are only picked when the CPU has it.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_X86
+#endif
+
+// Vectors of lanes doubles, the integer vectors of the same shape used for
+// the masks comparisons produce, and the attributes their kernels need
+#define KERNELS(suffix, lanes, attributes)                                     \
+    typedef double v##suffix __attribute__((vector_size(lanes * 8)));          \
+    typedef long long m##suffix __attribute__((vector_size(lanes * 8)));       \
+                                                                               \
+    attributes static void binary_##suffix(                                    \
+        SimdOp op, double *out, const double *a, size_t a_step,                \
+        const double *b, size_t b_step, size_t padded) {                       \
+        const v##suffix *va = (const v##suffix *)a;                            \
+        const v##suffix *vb = (const v##suffix *)b;                            \
+        v##suffix *vo = (v##suffix *)out;                                      \
+        m##suffix one = (m##suffix)((v##suffix){0} + 1.0);                     \
+        size_t count = padded / lanes;                                         \
+        switch (op) {                                                          \
+        case SIMD_ADD:                                                         \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = va[i * a_step] + vb[i * b_step];                       \
+            }                                                                  \
+            break;                                                             \
+        case SIMD_SUBTRACT:                                                    \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = va[i * a_step] - vb[i * b_step];                       \
+            }                                                                  \
+            break;                                                             \
+        case SIMD_MULTIPLY:                                                    \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = va[i * a_step] * vb[i * b_step];                       \
+            }                                                                  \
+            break;                                                             \
+        case SIMD_DIVIDE:                                                      \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = va[i * a_step] / vb[i * b_step];                       \
+            }                                                                  \
+            break;                                                             \
+        case SIMD_GREATER:                                                     \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = (v##suffix)((va[i * a_step] > vb[i * b_step]) & one);  \
+            }                                                                  \
+            break;                                                             \
+        case SIMD_LESS:                                                        \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = (v##suffix)((va[i * a_step] < vb[i * b_step]) & one);  \
+            }                                                                  \
+            break;                                                             \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    attributes static void unary_##suffix(SimdUnaryOp op, double *out,         \
+                                          const double *a, size_t padded) {    \
+        const v##suffix *va = (const v##suffix *)a;                            \
+        v##suffix *vo = (v##suffix *)out;                                      \
+        m##suffix one = (m##suffix)((v##suffix){0} + 1.0);                     \
+        size_t count = padded / lanes;                                         \
+        switch (op) {                                                          \
+        case SIMD_NEGATE:                                                      \
+            for (size_t i = 0; i < count; i++) vo[i] = -va[i];                 \
+            break;                                                             \
+        case SIMD_NOT:                                                         \
+            for (size_t i = 0; i < count; i++) {                               \
+                vo[i] = (v##suffix)((va[i] == 0.0) & one);                     \
+            }                                                                  \
+            break;                                                             \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    attributes static double sum_##suffix(const double *a, size_t length) {    \
+        const v##suffix *va = (const v##suffix *)a;                            \
+        v##suffix acc = {0};                                                   \
+        size_t count = length / lanes;                                         \
+        for (size_t i = 0; i < count; i++) acc += va[i];                       \
+        double sum = 0;                                                        \
+        for (size_t i = 0; i < lanes; i++) sum += acc[i];                      \
+        for (size_t i = count * lanes; i < length; i++) sum += a[i];           \
+        return sum;                                                            \
+    }                                                                          \
+                                                                               \
+    attributes static double dot_##suffix(const double *a, const double *b,    \
+                                          size_t length) {                     \
+        const v##suffix *va = (const v##suffix *)a;                            \
+        const v##suffix *vb = (const v##suffix *)b;                            \
+        v##suffix acc = {0};                                                   \
+        size_t count = length / lanes;                                         \
+        for (size_t i = 0; i < count; i++) acc += va[i] * vb[i];               \
+        double sum = 0;                                                        \
+        for (size_t i = 0; i < lanes; i++) sum += acc[i];                      \
+        for (size_t i = count * lanes; i < length; i++) sum += a[i] * b[i];    \
+        return sum;                                                            \
+    }                                                                          \
+                                                                               \
+    /* Keeps the smaller (or larger with sign -1) lane wise, blending with  */ \
+    /* masks since C has no vector ?: */                                       \
+    attributes static double extreme_##suffix(const double *a, size_t length,  \
+                                              double sign) {                   \
+        const v##suffix *va = (const v##suffix *)a;                            \
+        size_t count = length / lanes;                                         \
+        double best = a[0] * sign;                                             \
+        if (count > 0) {                                                       \
+            v##suffix acc = va[0] * sign;                                      \
+            for (size_t i = 1; i < count; i++) {                               \
+                v##suffix x = va[i] * sign;                                    \
+                m##suffix less = x < acc;                                      \
+                acc = (v##suffix)(((m##suffix)x & less) |                      \
+                                  ((m##suffix)acc & ~less));                   \
+            }                                                                  \
+            for (size_t i = 0; i < lanes; i++) {                               \
+                if (acc[i] < best) best = acc[i];                              \
+            }                                                                  \
+        }                                                                      \
+        for (size_t i = count * lanes; i < length; i++) {                      \
+            if (a[i] * sign < best) best = a[i] * sign;                        \
+        }                                                                      \
+        return best * sign;                                                    \
+    }
+
+#ifdef SIMD_X86
+KERNELS(avx2, 4, __attribute__((target("avx2"))))
+KERNELS(sse2, 2, )
+
+static bool has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+#else
+static void binary_scalar(SimdOp op, double *out, const double *a,
+                          size_t a_step, const double *b, size_t b_step,
+                          size_t padded) {
+    for (size_t i = 0; i < padded; i++) {
+        double x = a[i * a_step], y = b[i * b_step];
+        switch (op) {
+        case SIMD_ADD     : out[i] = x + y; break;
+        case SIMD_SUBTRACT: out[i] = x - y; break;
+        case SIMD_MULTIPLY: out[i] = x * y; break;
+        case SIMD_DIVIDE  : out[i] = x / y; break;
+        case SIMD_GREATER : out[i] = x > y; break;
+        case SIMD_LESS    : out[i] = x < y; break;
+        }
+    }
+}
+#endif
+
+void simd_binary(SimdOp op, double *out, const double *a, bool a_scalar,
+                 const double *b, bool b_scalar, size_t padded) {
+#ifdef SIMD_X86
+    // A scalar operand is a single vector that every iteration reads
+    if (has_avx2()) {
+        binary_avx2(op, out, a, !a_scalar, b, !b_scalar, padded);
+    } else {
+        binary_sse2(op, out, a, !a_scalar, b, !b_scalar, padded);
+    }
+#else
+    binary_scalar(op, out, a, !a_scalar, b, !b_scalar, padded);
+#endif
+}
+
+void simd_unary(SimdUnaryOp op, double *out, const double *a, size_t padded) {
+#ifdef SIMD_X86
+    if (has_avx2()) unary_avx2(op, out, a, padded);
+    else unary_sse2(op, out, a, padded);
+#else
+    for (size_t i = 0; i < padded; i++) {
+        out[i] = op == SIMD_NEGATE ? -a[i] : a[i] == 0.0;
+    }
+#endif
+}
+
+double simd_sum(const double *a, size_t length) {
+#ifdef SIMD_X86
+    return has_avx2() ? sum_avx2(a, length) : sum_sse2(a, length);
+#else
+    double sum = 0;
+    for (size_t i = 0; i < length; i++) sum += a[i];
+    return sum;
+#endif
+}
+
+double simd_dot(const double *a, const double *b, size_t length) {
+#ifdef SIMD_X86
+    return has_avx2() ? dot_avx2(a, b, length) : dot_sse2(a, b, length);
+#else
+    double sum = 0;
+    for (size_t i = 0; i < length; i++) sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+// Negating turns max into min, so both share one kernel
+static double extreme(const double *a, size_t length, double sign) {
+#ifdef SIMD_X86
+    return has_avx2() ? extreme_avx2(a, length, sign)
+                      : extreme_sse2(a, length, sign);
+#else
+    double best = a[0] * sign;
+    for (size_t i = 1; i < length; i++) {
+        if (a[i] * sign < best) best = a[i] * sign;
+    }
+    return best * sign;
+#endif
+}
+
+// length must be at least 1
+double simd_min(const double *a, size_t length) {
+    return extreme(a, length, 1.0);
+}
+
+double simd_max(const double *a, size_t length) {
+    return extreme(a, length, -1.0);
+}
+
+const char *simd_level(void) {
+#ifdef SIMD_X86
+    return has_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,136 @@
+#include "slab.h"
+#include "common.h"
+#include "memory.h"
+
+// Pages start with their list link, padded so that blocks stay aligned
+#define PAGE_HEADER SLAB_GRANULE
+
+static _Thread_local struct {
+    u64 generation;
+    SlabCache classes[SLAB_CLASSES];
+} local;
+
+// Starts at 1 so that a thread's zeroed cache never matches a slab
+static atomic_uint_fast64_t generations = 1;
+
+void init_slab(Slab *slab) {
+    pthread_mutex_init(&slab->lock, NULL);
+    slab->generation = atomic_fetch_add(&generations, 1);
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab->classes[i].pages = NULL;
+        slab->classes[i].page_count = 0;
+        atomic_init(&slab->classes[i].live, 0);
+        atomic_init(&slab->classes[i].peak, 0);
+    }
+}
+
+// Releases every page at once, whether or not the blocks in it were freed.
+// No other thread may be using the slab.
+void free_slab(Slab *slab) {
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        SlabPage *page = slab->classes[i].pages;
+        while (page != NULL) {
+            SlabPage *next = page->next;
+            FREE_ARRAY(u8, page, SLAB_PAGE_SIZE);
+            page = next;
+        }
+    }
+    pthread_mutex_destroy(&slab->lock);
+    init_slab(slab);
+}
+
+static size_t class_index(size_t size) {
+    return size == 0 ? 0 : (size - 1) / SLAB_GRANULE;
+}
+
+static size_t class_size(size_t index) { return (index + 1) * SLAB_GRANULE; }
+
+static SlabCache *local_cache(Slab *slab, size_t index) {
+    if (local.generation != slab->generation) {
+        memset(&local, 0, sizeof(local));
+        local.generation = slab->generation;
+    }
+    return &local.classes[index];
+}
+
+static void add_page(Slab *slab, SizeClass *class, SlabCache *cache) {
+    SlabPage *page = (SlabPage *)ALLOCATE(u8, SLAB_PAGE_SIZE);
+    pthread_mutex_lock(&slab->lock);
+    page->next = class->pages;
+    class->pages = page;
+    class->page_count++;
+    pthread_mutex_unlock(&slab->lock);
+    cache->next = (u8 *)page + PAGE_HEADER;
+    cache->end = (u8 *)page + SLAB_PAGE_SIZE;
+}
+
+void *slab_alloc(Slab *slab, size_t size) {
+    if (size > SLAB_MAX) return reallocate(NULL, size);
+
+    size_t index = class_index(size);
+    SizeClass *class = &slab->classes[index];
+    SlabCache *cache = local_cache(slab, index);
+    void *block;
+    if (cache->free != NULL) {
+        block = cache->free;
+        cache->free = cache->free->next;
+    } else {
+        size_t block_size = class_size(index);
+        if (cache->next == NULL ||
+            (size_t)(cache->end - cache->next) < block_size) {
+            add_page(slab, class, cache);
+        }
+        block = cache->next;
+        cache->next += block_size;
+    }
+
+    size_t live =
+        atomic_fetch_add_explicit(&class->live, 1, memory_order_relaxed) + 1;
+    size_t peak = atomic_load_explicit(&class->peak, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&class->peak, &peak, live,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {}
+    return block;
+}
+
+// size must be the same that the block was allocated with. The block goes
+// to the freeing thread's cache, whichever thread allocated it.
+void slab_free(Slab *slab, void *pointer, size_t size) {
+    if (pointer == NULL) return;
+    if (size > SLAB_MAX) {
+        reallocate(pointer, 0);
+        return;
+    }
+
+    size_t index = class_index(size);
+    SlabCache *cache = local_cache(slab, index);
+    SlabBlock *block = pointer;
+    block->next = cache->free;
+    cache->free = block;
+    atomic_fetch_sub_explicit(&slab->classes[index].live, 1,
+                              memory_order_relaxed);
+}
+
+void print_slab_stats(Slab *slab, FILE *file) {
+    size_t pages = 0, live = 0, used = 0;
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        SizeClass *class = &slab->classes[i];
+        if (class->page_count == 0) continue;
+
+        size_t per_page = (SLAB_PAGE_SIZE - PAGE_HEADER) / class_size(i);
+        size_t capacity = class->page_count * per_page;
+        size_t class_live = atomic_load(&class->live);
+        fprintf(file,
+                "slab %3zu bytes: %zu/%zu blocks live (%.1f%%), %zu peak, "
+                "%zu pages\n",
+                class_size(i), class_live, capacity,
+                100.0 * (double)class_live / (double)capacity,
+                (size_t)atomic_load(&class->peak), class->page_count);
+        pages += class->page_count;
+        live += class_live;
+        used += class_live * class_size(i);
+    }
+    fprintf(file, "slab: %zu live blocks, %zu/%zu bytes in %zu pages\n", live,
+            used, pages * SLAB_PAGE_SIZE, pages);
+}
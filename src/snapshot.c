@@ -0,0 +1,479 @@
+#include "snapshot.h"
+#include "cache.h"
+#include "chunk.h"
+#include "common.h"
+#include "globals.h"
+#include "intern.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "simd.h"
+#include "vm.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern VM vm;
+
+#define SNAPSHOT_MAGIC "CLOXSNAP"
+
+// Changes whenever a struct or the instruction set the image depends on
+// does, so that images from a different build are rejected instead of
+// misread
+#define SNAPSHOT_LAYOUT                                                        \
+    ((u64)sizeof(ObjString) << 48 | (u64)sizeof(ObjArray) << 40 |              \
+     (u64)sizeof(Value) << 32 | (u64)INTERN_TAG_SHIFT << 24 |                  \
+     (u64)INTERN_SHARDS << 8 | (u64)(OP_LESS_INT + 1))
+
+// Offsets are from the start of the image
+typedef struct {
+    char magic[8];
+    u32 version;
+    u64 layout;
+    u64 size;
+    u64 fixups, fixup_count;
+    u64 shards;
+    u64 chunks, chunk_count;
+    // Offsets of the names of the global slots, in slot order. Cached
+    // chunks refer to globals by slot, so the loader has to recreate the
+    // same slots for them.
+    u64 globals, global_count;
+    // Cached chunks call natives by index, see natives_fingerprint()
+    u64 natives;
+} SnapshotHeader;
+
+// An intern shard's slots, each holding its tag and the offset of its
+// string, which the loader relocates as it copies them out
+typedef struct {
+    u64 count, capacity;
+    u64 slots;
+} SnapshotSet;
+
+// A cache entry, oldest first so that loading them in order leaves the
+// cache's recency list as it was
+typedef struct {
+    u64 hash;
+    u64 length, source;
+    u64 count, code;
+    u64 constant_count, constants;
+    u64 line_count, lines;
+} SnapshotChunk;
+
+typedef struct {
+    size_t count, alloc;
+    u8 *data;
+    // Offsets of the pointer fields the loader has to relocate
+    size_t fixup_count, fixup_alloc;
+    u64 *fixups;
+} Image;
+
+// Where each object written so far ended up in the image, so that objects
+// referenced more than once are only written once
+typedef struct {
+    Obj *obj;
+    size_t offset;
+} Placement;
+
+typedef struct {
+    size_t count, alloc;
+    Placement *items;
+} PlacementMap;
+
+static size_t align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Appends size zeroed bytes aligned to alignment, returning their offset.
+// The image may move, so pointers into it don't survive a reserve.
+static size_t reserve(Image *image, size_t size, size_t alignment) {
+    size_t offset = align_up(image->count, alignment);
+    if (offset + size > image->alloc) {
+        size_t old_alloc = image->alloc;
+        size_t new_alloc = GROW_CAPACITY(old_alloc);
+        while (new_alloc < offset + size) new_alloc = GROW_CAPACITY(new_alloc);
+        image->data = GROW_ARRAY(u8, image->data, old_alloc, new_alloc);
+        memset(image->data + old_alloc, 0, new_alloc - old_alloc);
+        image->alloc = new_alloc;
+    }
+    image->count = offset + size;
+    return offset;
+}
+
+// Stores offset in the pointer field at field and records the field
+static void write_pointer(Image *image, size_t field, size_t offset) {
+    u64 value = offset;
+    memcpy(image->data + field, &value, sizeof(value));
+    if (image->fixup_alloc < image->fixup_count + 1) {
+        size_t old_alloc = image->fixup_alloc;
+        image->fixup_alloc = GROW_CAPACITY(old_alloc);
+        image->fixups =
+            GROW_ARRAY(u64, image->fixups, old_alloc, image->fixup_alloc);
+    }
+    image->fixups[image->fixup_count++] = field;
+}
+
+static size_t place_slot(PlacementMap *map, Obj *obj) {
+    size_t index = ((uintptr_t)obj >> 4) * 0x9E3779B97F4A7C15u % map->alloc;
+    while (map->items[index].obj != NULL && map->items[index].obj != obj) {
+        index = (index + 1) % map->alloc;
+    }
+    return index;
+}
+
+static Placement *find_placement(PlacementMap *map, Obj *obj) {
+    if (map->count + 1 > map->alloc / 2) {
+        size_t old_alloc = map->alloc;
+        Placement *old_items = map->items;
+        map->alloc = GROW_CAPACITY(old_alloc);
+        map->items = ALLOCATE(Placement, map->alloc);
+        for (size_t i = 0; i < map->alloc; i++) map->items[i].obj = NULL;
+        for (size_t i = 0; i < old_alloc; i++) {
+            if (old_items[i].obj == NULL) continue;
+            map->items[place_slot(map, old_items[i].obj)] = old_items[i];
+        }
+        FREE_ARRAY(Placement, old_items, old_alloc);
+    }
+    return &map->items[place_slot(map, obj)];
+}
+
+static size_t write_string(Image *image, ObjString *string) {
+    size_t offset =
+        reserve(image, sizeof(ObjString) + string->length + 1,
+                _Alignof(ObjString));
+    // The characters follow the string in the image, which it borrows them
+    // from once loaded
+    ObjString copy = {{OBJ_STRING, NULL}, string->length, NULL, string->hash,
+                      string->interned, true};
+    memcpy(image->data + offset, &copy, sizeof(copy));
+    memcpy(image->data + offset + sizeof(ObjString), string->chars,
+           string->length);
+    write_pointer(image, offset + offsetof(ObjString, chars),
+                  offset + sizeof(ObjString));
+    return offset;
+}
+
+static size_t write_array(Image *image, ObjArray *array) {
+    size_t offset = reserve(image, sizeof(ObjArray), _Alignof(ObjArray));
+    size_t items = reserve(image, array->padded * sizeof(double),
+                           SIMD_ALIGNMENT);
+    ObjArray copy = {{OBJ_ARRAY, NULL}, array->length, array->padded, NULL};
+    memcpy(image->data + offset, &copy, sizeof(copy));
+    memcpy(image->data + items, array->items, array->padded * sizeof(double));
+    write_pointer(image, offset + offsetof(ObjArray, items), items);
+    return offset;
+}
+
+static size_t write_obj(Image *image, PlacementMap *map, Obj *obj) {
+    Placement *placement = find_placement(map, obj);
+    if (placement->obj != NULL) return placement->offset;
+
+    size_t offset = 0;
+    switch (obj->type) {
+    case OBJ_STRING: offset = write_string(image, (ObjString *)obj); break;
+    case OBJ_ARRAY : offset = write_array(image, (ObjArray *)obj); break;
+    }
+    // Writing may have grown the map, so the slot is looked up again
+    placement = find_placement(map, obj);
+    placement->obj = obj;
+    placement->offset = offset;
+    map->count++;
+    return offset;
+}
+
+static void write_value(Image *image, PlacementMap *map, size_t field,
+                        Value value) {
+    Value copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.type = value.type;
+    if (!IS_OBJ(value)) copy.as = value.as;
+    memcpy(image->data + field, &copy, sizeof(copy));
+    if (IS_OBJ(value)) {
+        size_t offset = write_obj(image, map, AS_OBJ(value));
+        write_pointer(image, field + offsetof(Value, as), offset);
+    }
+}
+
+static void write_strings(Image *image, PlacementMap *map, size_t shards) {
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternSet *set = &vm.strings.shards[i].set;
+        size_t slots =
+            reserve(image, set->capacity * sizeof(u64), _Alignof(u64));
+        for (size_t j = 0; j < set->capacity; j++) {
+            uintptr_t slot = set->slots[j];
+            if (slot == 0) continue;
+            Obj *string = (Obj *)(slot & INTERN_ADDRESS_MASK);
+            u64 saved = (slot & ~INTERN_ADDRESS_MASK) |
+                        write_obj(image, map, string);
+            memcpy(image->data + slots + j * sizeof(u64), &saved,
+                   sizeof(saved));
+        }
+
+        SnapshotSet header = {set->count, set->capacity, slots};
+        memcpy(image->data + shards + i * sizeof(SnapshotSet), &header,
+               sizeof(header));
+    }
+}
+
+static void write_chunks(Image *image, PlacementMap *map, size_t chunks) {
+    size_t i = 0;
+    for (CacheEntry *entry = vm.cache.oldest; entry != NULL;
+         entry = entry->newer, i++) {
+        Chunk *chunk = &entry->chunk;
+        SnapshotChunk header;
+        header.hash = entry->hash;
+        header.length = entry->length;
+        header.source = reserve(image, entry->length + 1, 1);
+        memcpy(image->data + header.source, entry->source, entry->length);
+        header.count = chunk->count;
+        header.code = reserve(image, chunk->count, 1);
+        memcpy(image->data + header.code, chunk->code, chunk->count);
+        header.line_count = chunk->lines.count;
+        header.lines = reserve(image, chunk->lines.count * sizeof(size_t),
+                               _Alignof(size_t));
+        memcpy(image->data + header.lines, chunk->lines.items,
+               chunk->lines.count * sizeof(size_t));
+        header.constant_count = chunk->constants.count;
+        header.constants =
+            reserve(image, chunk->constants.count * sizeof(Value),
+                    _Alignof(Value));
+        for (size_t j = 0; j < chunk->constants.count; j++) {
+            write_value(image, map, header.constants + j * sizeof(Value),
+                        chunk->constants.items[j]);
+        }
+        memcpy(image->data + chunks + i * sizeof(SnapshotChunk), &header,
+               sizeof(header));
+    }
+}
+
+static void write_globals(Image *image, PlacementMap *map, size_t globals) {
+    for (size_t i = 0; i < vm.globals.count; i++) {
+        size_t name = write_obj(image, map, (Obj *)vm.globals.names[i]);
+        write_pointer(image, globals + i * sizeof(u64), name);
+    }
+}
+
+bool write_snapshot(const char *path) {
+    Image image = {0, 0, NULL, 0, 0, NULL};
+    PlacementMap map = {0, 0, NULL};
+
+    size_t chunk_count = 0;
+    for (CacheEntry *entry = vm.cache.oldest; entry != NULL;
+         entry = entry->newer) {
+        chunk_count++;
+    }
+
+    reserve(&image, sizeof(SnapshotHeader), _Alignof(SnapshotHeader));
+    size_t shards = reserve(&image, INTERN_SHARDS * sizeof(SnapshotSet),
+                            _Alignof(SnapshotSet));
+    size_t chunks = reserve(&image, chunk_count * sizeof(SnapshotChunk),
+                            _Alignof(SnapshotChunk));
+    size_t globals = reserve(&image, vm.globals.count * sizeof(u64),
+                             _Alignof(u64));
+    write_strings(&image, &map, shards);
+    write_chunks(&image, &map, chunks);
+    write_globals(&image, &map, globals);
+
+    size_t fixups = reserve(&image, image.fixup_count * sizeof(u64),
+                            _Alignof(u64));
+    memcpy(image.data + fixups, image.fixups, image.fixup_count * sizeof(u64));
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.layout = SNAPSHOT_LAYOUT;
+    header.size = image.count;
+    header.fixups = fixups;
+    header.fixup_count = image.fixup_count;
+    header.shards = shards;
+    header.chunks = chunks;
+    header.chunk_count = chunk_count;
+    header.globals = globals;
+    header.global_count = vm.globals.count;
+    header.natives = natives_fingerprint(&vm.natives);
+    memcpy(image.data, &header, sizeof(header));
+
+    bool written = false;
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        written = fwrite(image.data, 1, image.count, file) == image.count;
+        written = fclose(file) == 0 && written;
+    }
+    if (!written) fprintf(stderr, "Could not write snapshot \"%s\".\n", path);
+
+    FREE_ARRAY(Placement, map.items, map.alloc);
+    FREE_ARRAY(u64, image.fixups, image.fixup_alloc);
+    FREE_ARRAY(u8, image.data, image.alloc);
+    return written;
+}
+
+static bool snapshot_error(const char *path, const char *message) {
+    fprintf(stderr, "Could not load snapshot \"%s\": %s\n", path, message);
+    return false;
+}
+
+static bool check_header(const SnapshotHeader *header, size_t size) {
+    if (size < sizeof(SnapshotHeader)) return false;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->layout != SNAPSHOT_LAYOUT || header->size != size) {
+        return false;
+    }
+    return header->fixups <= size &&
+           header->fixup_count <= (size - header->fixups) / sizeof(u64) &&
+           size >= INTERN_SHARDS * sizeof(SnapshotSet) &&
+           header->shards <= size - INTERN_SHARDS * sizeof(SnapshotSet) &&
+           header->chunks <= size &&
+           header->chunk_count <=
+               (size - header->chunks) / sizeof(SnapshotChunk) &&
+           header->globals <= size && header->global_count <= GLOBALS_MAX &&
+           header->global_count <= (size - header->globals) / sizeof(u64);
+}
+
+static bool in_image(const SnapshotHeader *header, u64 offset, u64 count,
+                     size_t size) {
+    return offset <= header->size && count <= (header->size - offset) / size;
+}
+
+static bool check_sections(const u8 *base, const SnapshotHeader *header) {
+    const SnapshotSet *sets =
+        (const SnapshotSet *)(base + header->shards);
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        // Probes stop at an empty slot, so a full set would never end them
+        u64 capacity = sets[i].capacity;
+        if ((capacity & (capacity - 1)) != 0 ||
+            (capacity > 0 && sets[i].count >= capacity) ||
+            !in_image(header, sets[i].slots, capacity, sizeof(u64))) {
+            return false;
+        }
+        const u64 *slots = (const u64 *)(base + sets[i].slots);
+        for (u64 j = 0; j < capacity; j++) {
+            if ((slots[j] & INTERN_ADDRESS_MASK) >= header->size) {
+                return false;
+            }
+        }
+    }
+    const SnapshotChunk *chunks =
+        (const SnapshotChunk *)(base + header->chunks);
+    for (u64 i = 0; i < header->chunk_count; i++) {
+        const SnapshotChunk *chunk = &chunks[i];
+        if (!in_image(header, chunk->source, chunk->length + 1, 1) ||
+            !in_image(header, chunk->code, chunk->count, 1) ||
+            !in_image(header, chunk->lines, chunk->line_count,
+                      sizeof(size_t)) ||
+            !in_image(header, chunk->constants, chunk->constant_count,
+                      sizeof(Value))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Turns every offset listed in the fixup table into an address inside the
+// mapping at base
+static bool relocate(u8 *base, const SnapshotHeader *header) {
+    const u64 *fixups = (const u64 *)(base + header->fixups);
+    for (u64 i = 0; i < header->fixup_count; i++) {
+        if (fixups[i] > header->size - sizeof(u64)) return false;
+        u64 offset;
+        memcpy(&offset, base + fixups[i], sizeof(offset));
+        if (offset >= header->size) return false;
+        uintptr_t address = (uintptr_t)base + offset;
+        memcpy(base + fixups[i], &address, sizeof(address));
+    }
+    return true;
+}
+
+static void load_strings(u8 *base, const SnapshotHeader *header) {
+    const SnapshotSet *sets =
+        (const SnapshotSet *)(base + header->shards);
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternSet *set = &vm.strings.shards[i].set;
+        free_intern_set(set);
+        set->count = sets[i].count;
+        set->capacity = sets[i].capacity;
+        if (set->capacity == 0) continue;
+        set->slots = ALLOCATE(uintptr_t, set->capacity);
+        const u64 *slots = (const u64 *)(base + sets[i].slots);
+        for (size_t j = 0; j < set->capacity; j++) {
+            set->slots[j] = slots[j] == 0 ? 0 : slots[j] + (uintptr_t)base;
+        }
+    }
+}
+
+static void load_chunks(u8 *base, const SnapshotHeader *header) {
+    const SnapshotChunk *chunks =
+        (const SnapshotChunk *)(base + header->chunks);
+    for (u64 i = 0; i < header->chunk_count; i++) {
+        const SnapshotChunk *saved = &chunks[i];
+        Chunk chunk;
+        init_chunk(&chunk);
+        chunk.count = chunk.alloc = saved->count;
+        chunk.code = base + saved->code;
+        chunk.lines.count = chunk.lines.alloc = saved->line_count;
+        chunk.lines.items = (size_t *)(base + saved->lines);
+        chunk.constants.count = chunk.constants.alloc = saved->constant_count;
+        chunk.constants.items = (Value *)(base + saved->constants);
+        cache_insert(&vm.cache, (const char *)(base + saved->source),
+                     saved->length, (u32)saved->hash, &chunk);
+    }
+}
+
+// Names were written once each, so the slots come out numbered as they
+// were when the image was written
+static void load_globals(u8 *base, const SnapshotHeader *header) {
+    ObjString **names = (ObjString **)(base + header->globals);
+    for (u64 i = 0; i < header->global_count; i++) {
+        global_slot(&vm.globals, names[i]);
+    }
+}
+
+bool load_snapshot(const char *path) {
+    if (vm.snapshot != NULL) return snapshot_error(path, "already loaded.");
+    bool empty = vm.cache.newest == NULL && vm.globals.count == 0;
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        if (vm.strings.shards[i].set.count > 0) empty = false;
+    }
+    if (!empty) return snapshot_error(path, "the VM isn't empty.");
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return snapshot_error(path, "can't open it.");
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size == 0) {
+        close(fd);
+        return snapshot_error(path, "can't read it.");
+    }
+    size_t size = (size_t)info.st_size;
+    // Private so that relocating the image doesn't write to the file
+    u8 *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return snapshot_error(path, "can't map it.");
+
+    SnapshotHeader header;
+    if (size >= sizeof(header)) memcpy(&header, base, sizeof(header));
+    if (!check_header(&header, size) || !check_sections(base, &header) ||
+        !relocate(base, &header)) {
+        munmap(base, size);
+        return snapshot_error(path, "it's corrupt or from another build.");
+    }
+    if (header.natives != natives_fingerprint(&vm.natives)) {
+        munmap(base, size);
+        return snapshot_error(path, "it was saved with other natives.");
+    }
+
+    load_strings(base, &header);
+    load_chunks(base, &header);
+    load_globals(base, &header);
+    vm.snapshot = base;
+    vm.snapshot_size = size;
+    return true;
+}
+
+void free_snapshot(void) {
+    if (vm.snapshot == NULL) return;
+    munmap(vm.snapshot, vm.snapshot_size);
+    vm.snapshot = NULL;
+    vm.snapshot_size = 0;
+}
@@ -0,0 +1,81 @@
+#include "stack.h"
+#include "common.h"
+#include "vm.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern VM vm;
+
+static struct sigaction previous;
+
+void init_value_stack(ValueStack *stack, size_t capacity) {
+    stack->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = capacity * sizeof(Value);
+    bytes = (bytes + stack->page_size - 1) / stack->page_size *
+            stack->page_size;
+
+    // Reserved as a whole without access, then opened up for everything
+    // but the guard page. MAP_NORESERVE leaves committing memory to the
+    // first touch of each page.
+    u8 *base = mmap(NULL, bytes + stack->page_size, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED ||
+        mprotect(base, bytes, PROT_READ | PROT_WRITE) != 0) {
+        exit(1);
+    }
+    stack->values = (Value *)base;
+    stack->capacity = bytes / sizeof(Value);
+    stack->guard = base + bytes;
+    stack->armed = false;
+}
+
+void free_value_stack(ValueStack *stack) {
+    munmap(stack->values, (size_t)(stack->guard - (u8 *)stack->values) +
+                              stack->page_size);
+    stack->values = NULL;
+    stack->capacity = 0;
+    stack->guard = NULL;
+}
+
+void trim_value_stack(ValueStack *stack) {
+    u8 *first = (u8 *)stack->values + stack->page_size;
+    if (first < stack->guard) {
+        madvise(first, (size_t)(stack->guard - first), MADV_DONTNEED);
+    }
+}
+
+static void on_segv(int signo, siginfo_t *info, void *context) {
+    ValueStack *stack = &vm.value_stack;
+    u8 *address = info->si_addr;
+    if (stack->armed && address >= stack->guard &&
+        address < stack->guard + stack->page_size) {
+        siglongjmp(stack->overflow, 1);
+    }
+
+    if (previous.sa_flags & SA_SIGINFO) {
+        previous.sa_sigaction(signo, info, context);
+    } else if (previous.sa_handler != SIG_DFL &&
+               previous.sa_handler != SIG_IGN) {
+        previous.sa_handler(signo);
+    } else {
+        // The fault comes back when the instruction is retried, and then
+        // gets the default treatment
+        sigaction(SIGSEGV, &previous, NULL);
+    }
+}
+
+void install_stack_guard(void) {
+    static bool installed = false;
+    if (installed) return;
+    installed = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_segv;
+    sigemptyset(&action.sa_mask);
+    // SIGSEGV isn't blocked while the handler runs, so that jumping out of
+    // it leaves the signal mask as it was without having to save it
+    action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK | SA_RESTART;
+    sigaction(SIGSEGV, &action, &previous);
+}
@@ -0,0 +1,194 @@
+#include "stream.h"
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+extern VM vm;
+
+#define READ_SIZE 65536
+
+typedef struct {
+    int fd;
+    char *buffer;
+    // Bytes in [start, end) have been read but not handed out yet
+    size_t alloc, start, end;
+    bool eof;
+} LineReader;
+
+typedef struct {
+    size_t count, alloc;
+    u64 *items;
+} LatencyArray;
+
+static void init_reader(LineReader *reader, int fd) {
+    reader->fd = fd;
+    reader->buffer = NULL;
+    reader->alloc = 0;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = false;
+}
+
+static void free_reader(LineReader *reader) {
+    FREE_ARRAY(char, reader->buffer, reader->alloc);
+    init_reader(reader, -1);
+}
+
+static bool fill_reader(LineReader *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    // The extra byte leaves room for the '\0' after a last line that
+    // doesn't end in a newline
+    if (reader->alloc < reader->end + READ_SIZE + 1) {
+        size_t old_alloc = reader->alloc;
+        reader->alloc = GROW_CAPACITY(old_alloc);
+        while (reader->alloc < reader->end + READ_SIZE + 1) {
+            reader->alloc = GROW_CAPACITY(reader->alloc);
+        }
+        reader->buffer =
+            GROW_ARRAY(char, reader->buffer, old_alloc, reader->alloc);
+    }
+
+    // Whoever is on the other side of the pipe may be waiting for the
+    // results so far before it sends any more input
+    flush_writer(&vm.out);
+
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(reader->fd, reader->buffer + reader->end, READ_SIZE);
+    } while (bytes_read < 0 && errno == EINTR);
+
+    if (bytes_read <= 0) {
+        reader->eof = true;
+        return false;
+    }
+    reader->end += bytes_read;
+    return true;
+}
+
+// Returns the next line with its newline replaced by '\0', or NULL once
+// the input is exhausted
+static char *next_line(LineReader *reader) {
+    size_t scanned = reader->start;
+    while (true) {
+        char *newline = NULL;
+        if (scanned < reader->end) {
+            newline = memchr(reader->buffer + scanned, '\n',
+                             reader->end - scanned);
+        }
+        if (newline != NULL) {
+            char *line = reader->buffer + reader->start;
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+            reader->start = newline - reader->buffer + 1;
+            return line;
+        }
+
+        scanned = reader->end - reader->start;
+        if (reader->eof || !fill_reader(reader)) break;
+    }
+
+    if (reader->start == reader->end) return NULL;
+    char *line = reader->buffer + reader->start;
+    reader->buffer[reader->end] = '\0';
+    reader->start = reader->end;
+    return line;
+}
+
+static void write_latency(LatencyArray *array, u64 latency) {
+    if (array->alloc < array->count + 1) {
+        size_t old_alloc = array->alloc;
+        array->alloc = GROW_CAPACITY(old_alloc);
+        array->items = GROW_ARRAY(u64, array->items, old_alloc, array->alloc);
+    }
+    array->items[array->count++] = latency;
+}
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000u + (u64)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(LatencyArray *sorted, double percentile) {
+    if (sorted->count == 0) return 0;
+    size_t index = (size_t)(percentile / 100 * (sorted->count - 1) + 0.5);
+    return sorted->items[index] / 1000.0;
+}
+
+static void report(LatencyArray *latencies, size_t errors, u64 elapsed) {
+    if (latencies->count > 0) {
+        qsort(latencies->items, latencies->count, sizeof(u64), compare_u64);
+    }
+
+    double seconds = elapsed / 1e9;
+    fprintf(stderr,
+            "eval-stream: %zu lines (%zu errors) in %.3fs, %.0f lines/s\n",
+            latencies->count, errors, seconds,
+            seconds > 0 ? latencies->count / seconds : 0);
+    fprintf(stderr,
+            "latency us: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+            percentile_us(latencies, 50), percentile_us(latencies, 90),
+            percentile_us(latencies, 99), percentile_us(latencies, 99.9),
+            percentile_us(latencies, 100));
+}
+
+int eval_stream(const char *path) {
+    int fd = STDIN_FILENO;
+    if (path != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Could not open file \"%s\".\n", path);
+            return 74;
+        }
+    }
+
+    LineReader reader;
+    init_reader(&reader, fd);
+    LatencyArray latencies = {0, 0, NULL};
+    size_t errors = 0;
+
+    // A single chunk is compiled into over and over, so after the first
+    // few lines its buffers are already large enough
+    Chunk chunk;
+    init_chunk(&chunk);
+
+    u64 start = now_ns();
+    char *line;
+    while ((line = next_line(&reader)) != NULL) {
+        u64 line_start = now_ns();
+        if (interpret_in(&chunk, line) != INTERPRET_OK) {
+            // Every line gets exactly one line of output, so that results
+            // can still be matched up with their input
+            write_cstr(&vm.out, "error\n");
+            errors++;
+        }
+        write_latency(&latencies, now_ns() - line_start);
+    }
+    u64 elapsed = now_ns() - start;
+    flush_writer(&vm.out);
+
+    report(&latencies, errors, elapsed);
+
+    free_chunk(&chunk);
+    FREE_ARRAY(u64, latencies.items, latencies.alloc);
+    free_reader(&reader);
+    if (fd != STDIN_FILENO) close(fd);
+    return 0;
+}
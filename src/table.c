@@ -2,6 +2,7 @@
 #include "common.h"
 #include "memory.h"
 #include "object.h"
+#include "probes.h"
 #include "value.h"
 
 #define TABLE_MAX_LOAD 0.75
@@ -37,6 +38,7 @@ static Entry *find_entry(Entry *entries, size_t alloc, ObjString *key) {
 }
 
 static void resize_table(Table *table, size_t new_alloc) {
+    PROBE3(resize_table, table, table->alloc, new_alloc);
     Entry *entries = ALLOCATE(Entry, new_alloc);
 
     for (size_t i = 0; i < new_alloc; i++) {
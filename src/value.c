@@ -2,6 +2,9 @@
 #include "common.h"
 #include "memory.h"
 #include "object.h"
+#include "vm.h"
+
+extern VM vm;
 
 void init_ValueArray(ValueArray *array) {
     array->count = 0;
@@ -27,23 +30,38 @@ void write_ValueArray(ValueArray *array, Value value) {
 
 void print_Value(Value value) {
     switch (value.type) {
-    case VAL_NIL   : printf("nil"); break;
-    case VAL_BOOL  : printf(AS_BOOL(value) ? "true" : "false"); break;
-    case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-    case VAL_OBJ:
-        print_obj(value);
-        break;
+    case VAL_NIL   : write_bytes(&vm.out, "nil", 3); break;
+    case VAL_BOOL:
+        if (AS_BOOL(value)) write_bytes(&vm.out, "true", 4);
+        else write_bytes(&vm.out, "false", 5);
         break;
+    case VAL_NUMBER: write_number(&vm.out, AS_NUMBER(value)); break;
+    case VAL_INT   : write_int(&vm.out, AS_INT(value)); break;
+    case VAL_OBJ   : print_obj(value); break;
     }
 }
 
 bool values_equal(Value a, Value b) {
-    if (a.type != b.type) return false;
+    if (a.type != b.type) {
+        // 1 == 1.0, since the two kinds of number mix everywhere else
+        if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+            return as_double(a) == as_double(b);
+        }
+        return false;
+    }
     switch (a.type) {
     case VAL_NIL   : return true;
     case VAL_BOOL  : return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-    case VAL_OBJ   : return AS_OBJ(a) == AS_OBJ(b);
+    case VAL_INT   : return AS_INT(a) == AS_INT(b);
+    case VAL_OBJ:
+        if (IS_STRING(a) && IS_STRING(b)) {
+            return str_equal(AS_STRING(a), AS_STRING(b));
+        }
+        if (IS_ARRAY(a) && IS_ARRAY(b)) {
+            return array_equal(AS_ARRAY(a), AS_ARRAY(b));
+        }
+        return AS_OBJ(a) == AS_OBJ(b);
     default        : return false;
     }
 }
@@ -1,14 +1,23 @@
 #include "vm.h"
+#include "array.h"
+#include "cache.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
+#include "probes.h"
+#include "recorder.h"
+#include "register.h"
+#include "snapshot.h"
+#include "stack.h"
 #include "value.h"
 
 VM vm;
 
-static void reset_stack(void) { vm.stack_top = (Value *)&vm.stack; }
+static void reset_stack(void) { vm.stack_top = vm.stack; }
 
 static bool stack_is_empty(void) { return (vm.stack == vm.stack_top); }
 
@@ -16,25 +25,26 @@ static bool stack_has(int items) { return (vm.stack == vm.stack_top - items); }
 
 static Value peek(int distance) { return vm.stack_top[-1 - distance]; }
 
-static bool is_falsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+// Replaces the operands of an arithmetic or comparison instruction with
+// its element-wise result when at least one of them is an array
+static bool array_binary_op(OpCode op) {
+    Value result;
+    if (!array_binary(op, peek(1), peek(0), &result)) return false;
+    vm.stack_top[-2] = result;
+    vm.stack_top--;
+    return true;
 }
 
 static void concatenate(void) {
     ObjString *b = AS_STRING(pop());
     ObjString *a = AS_STRING(pop());
-
-    size_t length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-
-    ObjString *result = take_str(chars, length);
-    push(OBJ_VAL((Obj *)result));
+    push(OBJ_VAL((Obj *)concat_str(a, b)));
 }
 
-static void vm_error(const char *format, ...) {
+void vm_error(const char *format, ...) {
+    // Keep whatever was printed so far ahead of the error message
+    flush_writer(&vm.out);
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -44,48 +54,173 @@ static void vm_error(const char *format, ...) {
     size_t instruction = vm.ip - vm.chunk->code - 1;
     size_t line = get_line(vm.chunk, instruction);
     fprintf(stderr, "[line %zu] in script\n", line);
+    if (vm.recorder.fd >= 0) {
+        dump_recorder(&vm.recorder, vm.recorder.fd, "runtime error");
+    }
     reset_stack();
 }
 
+void undefined_variable(u16 slot) {
+    ObjString *name = vm.globals.names[slot];
+    vm_error("Undefined variable '%.*s'.", (int)name->length, name->chars);
+}
+
+void pin_source(const char *source, size_t length, bool owned) {
+    if (vm.pinned_alloc < vm.pinned_count + 1) {
+        size_t old_alloc = vm.pinned_alloc;
+        vm.pinned_alloc = GROW_CAPACITY(old_alloc);
+        vm.pinned = GROW_ARRAY(PinnedSource, vm.pinned, old_alloc,
+                               vm.pinned_alloc);
+    }
+    vm.pinned[vm.pinned_count++] = (PinnedSource){source, length, owned};
+}
+
+// Whether source lies in a pinned buffer, in which case everything after
+// it up to the end of the buffer does as well
+bool source_pinned(const char *source) {
+    for (size_t i = 0; i < vm.pinned_count; i++) {
+        PinnedSource *pinned = &vm.pinned[i];
+        if (source >= pinned->start &&
+            source < pinned->start + pinned->length) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void init_VM(void) {
+    init_value_stack(&vm.value_stack, STACK_RESERVE);
+    vm.stack = vm.value_stack.values;
     reset_stack();
+    vm.fuel = FUEL_UNLIMITED;
     vm.objects = NULL;
-    init_table(&vm.strings);
+    init_slab(&vm.slab);
+    init_intern_table(&vm.strings);
+    init_globals(&vm.globals);
+    init_natives(&vm.natives);
+    vm.result = NIL_VAL;
+    vm.stats = (VMStats){0};
+    vm.backend = BACKEND_STACK;
+    vm.jit_threshold = 0;
+    vm.jit_perf_map = false;
+    vm.pipeline_threshold = 0;
+    vm.snapshot = NULL;
+    vm.snapshot_size = 0;
+    vm.pinned_count = 0;
+    vm.pinned_alloc = 0;
+    vm.pinned = NULL;
+    init_recorder(&vm.recorder);
+    init_writer(&vm.out, stdout);
+    init_cache(&vm.cache, CACHE_DEFAULT_BUDGET);
 }
 
 void free_VM(void) {
-    free_table(&vm.strings);
+    flush_writer(&vm.out);
+    free_cache(&vm.cache);
+    free_globals(&vm.globals);
+    free_natives(&vm.natives);
+    free_intern_table(&vm.strings);
     free_objects();
+    free_slab(&vm.slab);
+    free_snapshot();
+    free_value_stack(&vm.value_stack);
+    // Last, since strings borrowed from them were still around until now
+    for (size_t i = 0; i < vm.pinned_count; i++) {
+        if (vm.pinned[i].owned) free((char *)vm.pinned[i].start);
+    }
+    FREE_ARRAY(PinnedSource, vm.pinned, vm.pinned_alloc);
 }
 
 static InterpretResult run(void) {
     Value a, b;
 
 #define read_byte() (*vm.ip++)
+// Arrays never get a specialized instruction, so this goes ahead of the
+// number case and its quickening
+#define array_op(op)                                                           \
+    if (IS_ARRAY(peek(0)) || IS_ARRAY(peek(1))) {                              \
+        if (!array_binary_op(op)) return INTERPRET_RUNTIME_ERROR;              \
+        break;                                                                 \
+    }
 #define read_constant() (vm.chunk->constants.items[read_byte()])
-#define binary_op(valueType, op)                                               \
+#define read_slot() (vm.ip += 2, read_slot_operand(vm.ip - 2))
+// Quickens into the integer or the double version when both operands are
+// of that kind, mixed operands stay on the generic instruction
+#define binary_op(generic, int_version, number_version)                        \
     do {                                                                       \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                      \
+        if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {                    \
             vm_error("Operands must be numbers.");                             \
             return INTERPRET_RUNTIME_ERROR;                                    \
         }                                                                      \
-        double b = AS_NUMBER(pop());                                           \
-        double a = AS_NUMBER(pop());                                           \
-        push(valueType(a op b));                                               \
+        b = pop();                                                             \
+        a = pop();                                                             \
+        push(number_binary(generic, a, b));                                    \
+        if (IS_INT(a) && IS_INT(b)) quicken(int_version);                      \
+        else if (IS_NUMBER(a) && IS_NUMBER(b)) quicken(number_version);        \
+    } while (false)
+// Rewrites the instruction being executed into a version specialized for
+// the operand types just seen
+#define quicken(specialized)                                                   \
+    do {                                                                       \
+        vm.ip[-1] = (specialized);                                             \
+        vm.stats.quickened++;                                                  \
+    } while (false)
+// Turns a specialized instruction back into the generic one, which is then
+// executed in its place
+#define deoptimize(generic)                                                    \
+    do {                                                                       \
+        vm.ip[-1] = (generic);                                                 \
+        vm.ip--;                                                               \
+        vm.stats.deopts++;                                                     \
+    } while (false)
+#define number_op(generic, valueType, op)                                      \
+    do {                                                                       \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                      \
+            deoptimize(generic);                                               \
+            break;                                                             \
+        }                                                                      \
+        vm.stats.quick_hits++;                                                 \
+        vm.stack_top[-2] = valueType(AS_NUMBER(vm.stack_top[-2])               \
+                                         op AS_NUMBER(vm.stack_top[-1]));      \
+        vm.stack_top--;                                                        \
+    } while (false)
+// result is computed from the integers x and y
+#define int_op(generic, result)                                                \
+    do {                                                                       \
+        if (!IS_INT(peek(0)) || !IS_INT(peek(1))) {                            \
+            deoptimize(generic);                                               \
+            break;                                                             \
+        }                                                                      \
+        vm.stats.quick_hits++;                                                 \
+        i64 x = AS_INT(vm.stack_top[-2]), y = AS_INT(vm.stack_top[-1]);        \
+        vm.stack_top[-2] = (result);                                           \
+        vm.stack_top--;                                                        \
     } while (false)
 
     while (true) {
+        // Checked before every instruction since chunks have no jumps, so
+        // there are no basic block boundaries to check it at instead
+        if (vm.fuel == 0) {
+            vm.stats.yields++;
+            return INTERPRET_YIELD;
+        }
+        vm.fuel--;
 
 #ifdef DEBUG_TRACE_EXECUTION
-        printf("        ");
+        write_cstr(&vm.out, "        ");
         for (Value *slot = (Value *)vm.stack; slot < vm.stack_top; slot++) {
-            printf("[ ");
+            write_cstr(&vm.out, "[ ");
             print_Value(*slot);
-            printf(" ]");
+            write_cstr(&vm.out, " ]");
         }
-        printf("\n");
+        write_char(&vm.out, '\n');
         disassemble_instruction(vm.chunk, (size_t)(vm.ip - vm.chunk->code));
 #endif
+        vm.stats.dispatches++;
+        PROBE2(dispatch, vm.ip - vm.chunk->code, *vm.ip);
+        RECORD(&vm.recorder, vm.chunk, (size_t)(vm.ip - vm.chunk->code),
+               (size_t)(vm.stack_top - vm.stack),
+               stack_is_empty() ? NIL_VAL : peek(0));
         u8 instruction;
         switch (instruction = read_byte()) {
         case OP_CONSTANT: {
@@ -101,85 +236,402 @@ static InterpretResult run(void) {
             a = pop();
             push(BOOL_VAL(values_equal(a, b)));
             break;
-        case OP_GREATER: binary_op(BOOL_VAL, >); break;
-        case OP_LESS   : binary_op(BOOL_VAL, <); break;
-        case OP_NOT    : push(BOOL_VAL(is_falsey(pop()))); break;
+        case OP_GREATER:
+            array_op(OP_GREATER);
+            binary_op(OP_GREATER, OP_GREATER_INT, OP_GREATER_NUM);
+            break;
+        case OP_LESS:
+            array_op(OP_LESS);
+            binary_op(OP_LESS, OP_LESS_INT, OP_LESS_NUM);
+            break;
+        case OP_NOT:
+            a = pop();
+            push(IS_ARRAY(a) ? array_unary(OP_NOT, AS_ARRAY(a))
+                             : BOOL_VAL(is_falsey(a)));
+            break;
         case OP_NEGATE:
             if (stack_is_empty()) {
                 vm_error("Can't negate because the stack is empty.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            if (!IS_NUMBER(peek(0))) {
+            if (IS_ARRAY(peek(0))) {
+                push(array_unary(OP_NEGATE, AS_ARRAY(pop())));
+                break;
+            }
+            if (!IS_NUMERIC(peek(0))) {
                 vm_error("Operand must be an a number.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
-            push(NUMBER_VAL(-AS_NUMBER(pop())));
+            push(number_negate(pop()));
             break;
         case OP_ADD:
             if (stack_is_empty() || stack_has(1)) {
                 return INTERPRET_COMPILE_ERROR;
             } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                 concatenate();
-            } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                binary_op(NUMBER_VAL, +);
+                quicken(OP_ADD_STR);
+            } else if (IS_NUMERIC(peek(0)) && IS_NUMERIC(peek(1))) {
+                binary_op(OP_ADD, OP_ADD_INT, OP_ADD_NUM);
+            } else if (IS_ARRAY(peek(0)) || IS_ARRAY(peek(1))) {
+                if (!array_binary_op(OP_ADD)) return INTERPRET_RUNTIME_ERROR;
+            } else {
+                vm_error("Operands must be two numbers or two strings.");
+                return INTERPRET_RUNTIME_ERROR;
             }
             break;
         case OP_SUBTRACT:
             if (stack_is_empty() || stack_has(1)) {
                 return INTERPRET_COMPILE_ERROR;
             }
-            binary_op(NUMBER_VAL, -);
+            array_op(OP_SUBTRACT);
+            binary_op(OP_SUBTRACT, OP_SUBTRACT_INT, OP_SUBTRACT_NUM);
             break;
         case OP_MULTIPLY:
             if (stack_is_empty() || stack_has(1)) {
                 return INTERPRET_COMPILE_ERROR;
             }
-            binary_op(NUMBER_VAL, *);
+            array_op(OP_MULTIPLY);
+            binary_op(OP_MULTIPLY, OP_MULTIPLY_INT, OP_MULTIPLY_NUM);
             break;
         case OP_DIVIDE:
             if (stack_is_empty() || stack_has(1)) {
                 return INTERPRET_COMPILE_ERROR;
             }
-            binary_op(NUMBER_VAL, /);
+            array_op(OP_DIVIDE);
+            binary_op(OP_DIVIDE, OP_DIVIDE_INT, OP_DIVIDE_NUM);
+            break;
+        case OP_ADD_NUM     : number_op(OP_ADD, NUMBER_VAL, +); break;
+        case OP_SUBTRACT_NUM: number_op(OP_SUBTRACT, NUMBER_VAL, -); break;
+        case OP_MULTIPLY_NUM: number_op(OP_MULTIPLY, NUMBER_VAL, *); break;
+        case OP_DIVIDE_NUM  : number_op(OP_DIVIDE, NUMBER_VAL, /); break;
+        case OP_GREATER_NUM : number_op(OP_GREATER, BOOL_VAL, >); break;
+        case OP_LESS_NUM    : number_op(OP_LESS, BOOL_VAL, <); break;
+        case OP_ADD_INT     : int_op(OP_ADD, int_add(x, y)); break;
+        case OP_SUBTRACT_INT: int_op(OP_SUBTRACT, int_subtract(x, y)); break;
+        case OP_MULTIPLY_INT: int_op(OP_MULTIPLY, int_multiply(x, y)); break;
+        case OP_DIVIDE_INT  : int_op(OP_DIVIDE, int_divide(x, y)); break;
+        case OP_GREATER_INT : int_op(OP_GREATER, BOOL_VAL(x > y)); break;
+        case OP_LESS_INT    : int_op(OP_LESS, BOOL_VAL(x < y)); break;
+        case OP_ADD_STR:
+            if (!IS_STRING(peek(0)) || !IS_STRING(peek(1))) {
+                deoptimize(OP_ADD);
+                break;
+            }
+            vm.stats.quick_hits++;
+            concatenate();
+            break;
+        case OP_GET_GLOBAL: {
+            u16 slot = read_slot();
+            a = vm.globals.values[slot];
+            if (IS_UNDEFINED(a)) {
+                undefined_variable(slot);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            push(a);
+            break;
+        }
+        case OP_SET_GLOBAL: {
+            u16 slot = read_slot();
+            if (IS_UNDEFINED(vm.globals.values[slot])) {
+                undefined_variable(slot);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.globals.values[slot] = peek(0);
+            break;
+        }
+        case OP_DEFINE_GLOBAL: vm.globals.values[read_slot()] = peek(0); break;
+        case OP_POP          : pop(); break;
+        case OP_ARRAY: {
+            u8 count = read_byte();
+            Value *items = vm.stack_top - count;
+            ObjArray *array = new_array(count);
+            for (u8 i = 0; i < count; i++) {
+                if (!IS_NUMERIC(items[i])) {
+                    vm_error("Array elements must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                array->items[i] = as_double(items[i]);
+            }
+            vm.stack_top = items;
+            push(OBJ_VAL((Obj *)array));
+            break;
+        }
+        case OP_CALL_NATIVE: {
+            const Native *native = &vm.natives.items[read_byte()];
+            Value *args = vm.stack_top - native->arity;
+            const char *error = native->function(args, &a);
+            if (error != NULL) {
+                vm_error("%s", error);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.stack_top = args;
+            push(a);
             break;
-        case OP_RETURN:
-            print_Value(pop());
-            printf("\n");
-            return INTERPRET_OK;
+        }
+        case OP_RETURN: vm.result = pop(); return INTERPRET_OK;
         default: return INTERPRET_COMPILE_ERROR;
         }
     }
 
+#undef int_op
+#undef number_op
+#undef array_op
+#undef deoptimize
+#undef quicken
 #undef binary_op
+#undef read_slot
 #undef read_constant
 #undef read_byte
 }
 
-InterpretResult interpret(const char *source) {
-    Chunk chunk;
-    init_chunk(&chunk);
+void print_vm_stats(FILE *file) {
+    // Instructions of runs that fell back are reported on their own line
+    fprintf(file, "dispatch: %llu instructions on the %s machine\n",
+            (unsigned long long)(vm.stats.dispatches -
+                                 vm.stats.fallback_dispatches),
+            vm.backend == BACKEND_REGISTER ? "register" : "stack");
+    fprintf(file, "quickening: %llu rewrites, %llu hits, %llu deopts\n",
+            (unsigned long long)vm.stats.quickened,
+            (unsigned long long)vm.stats.quick_hits,
+            (unsigned long long)vm.stats.deopts);
+    fprintf(file, "jit: %llu chunks compiled, %llu native runs\n",
+            (unsigned long long)vm.stats.jit_compiles,
+            (unsigned long long)vm.stats.jit_runs);
+    fprintf(file, "fuel: %llu yields\n",
+            (unsigned long long)vm.stats.yields);
+    fprintf(file,
+            "register: %llu runs fell back to the stack machine, which "
+            "dispatched %llu instructions for them\n",
+            (unsigned long long)vm.stats.register_fallbacks,
+            (unsigned long long)vm.stats.fallback_dispatches);
+    fprintf(file, "batch: %llu rows as vectors, %llu one at a time\n",
+            (unsigned long long)vm.stats.batch_rows,
+            (unsigned long long)vm.stats.batch_fallbacks);
+}
+
+// Points vm.ip just past the stack instruction that i was translated from,
+// which is where vm_error() expects it when reporting the line
+static void sync_ip(RegChunk *reg_chunk, RegInstruction *i) {
+    vm.ip = vm.chunk->code + reg_chunk->offsets[i - reg_chunk->code] + 1;
+}
+
+// The value a register instruction reads first, for the flight recorder
+static inline Value first_operand(Value *r, RegInstruction *i) {
+    switch (i->op) {
+    case ROP_GET_GLOBAL: return NIL_VAL;
+    case ROP_RETURN    : return r[i->a];
+    default            : return r[i->b];
+    }
+}
+
+static InterpretResult run_registers(RegChunk *reg_chunk) {
+    Value *r = reg_chunk->registers;
+
+#define register_error(...)                                                    \
+    do {                                                                       \
+        sync_ip(reg_chunk, i);                                                 \
+        vm_error(__VA_ARGS__);                                                 \
+        return INTERPRET_RUNTIME_ERROR;                                        \
+    } while (false)
+#define array_op(generic)                                                      \
+    do {                                                                       \
+        sync_ip(reg_chunk, i);                                                 \
+        if (!array_binary(generic, r[i->b], r[i->c], &r[i->a])) {              \
+            return INTERPRET_RUNTIME_ERROR;                                    \
+        }                                                                      \
+    } while (false)
+#define number_op(generic, valueType, op)                                      \
+    do {                                                                       \
+        if (IS_NUMBER(r[i->b]) && IS_NUMBER(r[i->c])) {                        \
+            r[i->a] = valueType(AS_NUMBER(r[i->b]) op AS_NUMBER(r[i->c]));     \
+        } else if (IS_NUMERIC(r[i->b]) && IS_NUMERIC(r[i->c])) {               \
+            r[i->a] = number_binary(generic, r[i->b], r[i->c]);                \
+        } else if (IS_ARRAY(r[i->b]) || IS_ARRAY(r[i->c])) {                   \
+            array_op(generic);                                                 \
+        } else {                                                               \
+            register_error("Operands must be numbers.");                       \
+        }                                                                      \
+    } while (false)
+
+    for (RegInstruction *i = reg_chunk->code;; i++) {
+        vm.stats.dispatches++;
+        RECORD(&vm.recorder, vm.chunk, reg_chunk->offsets[i - reg_chunk->code],
+               0, first_operand(r, i));
+        switch (i->op) {
+        case ROP_NOT:
+            r[i->a] = IS_ARRAY(r[i->b]) ? array_unary(OP_NOT, AS_ARRAY(r[i->b]))
+                                        : BOOL_VAL(is_falsey(r[i->b]));
+            break;
+        case ROP_EQUAL:
+            r[i->a] = BOOL_VAL(values_equal(r[i->b], r[i->c]));
+            break;
+        case ROP_NEGATE:
+            if (IS_ARRAY(r[i->b])) {
+                r[i->a] = array_unary(OP_NEGATE, AS_ARRAY(r[i->b]));
+                break;
+            }
+            if (!IS_NUMERIC(r[i->b])) {
+                register_error("Operand must be an a number.");
+            }
+            r[i->a] = number_negate(r[i->b]);
+            break;
+        case ROP_ADD:
+            if (IS_NUMBER(r[i->b]) && IS_NUMBER(r[i->c])) {
+                r[i->a] = NUMBER_VAL(AS_NUMBER(r[i->b]) + AS_NUMBER(r[i->c]));
+            } else if (IS_NUMERIC(r[i->b]) && IS_NUMERIC(r[i->c])) {
+                r[i->a] = number_binary(OP_ADD, r[i->b], r[i->c]);
+            } else if (IS_STRING(r[i->b]) && IS_STRING(r[i->c])) {
+                r[i->a] = OBJ_VAL(
+                    (Obj *)concat_str(AS_STRING(r[i->b]), AS_STRING(r[i->c])));
+            } else if (IS_ARRAY(r[i->b]) || IS_ARRAY(r[i->c])) {
+                array_op(OP_ADD);
+            } else {
+                register_error("Operands must be two numbers or two strings.");
+            }
+            break;
+        case ROP_SUBTRACT: number_op(OP_SUBTRACT, NUMBER_VAL, -); break;
+        case ROP_MULTIPLY: number_op(OP_MULTIPLY, NUMBER_VAL, *); break;
+        case ROP_DIVIDE  : number_op(OP_DIVIDE, NUMBER_VAL, /); break;
+        case ROP_GREATER : number_op(OP_GREATER, BOOL_VAL, >); break;
+        case ROP_LESS    : number_op(OP_LESS, BOOL_VAL, <); break;
+        case ROP_GET_GLOBAL:
+            r[i->a] = vm.globals.values[i->b];
+            if (IS_UNDEFINED(r[i->a])) {
+                sync_ip(reg_chunk, i);
+                undefined_variable(i->b);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            break;
+        case ROP_SET_GLOBAL:
+            if (IS_UNDEFINED(vm.globals.values[i->a])) {
+                sync_ip(reg_chunk, i);
+                undefined_variable(i->a);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.globals.values[i->a] = r[i->b];
+            break;
+        case ROP_DEFINE_GLOBAL: vm.globals.values[i->a] = r[i->b]; break;
+        case ROP_RETURN: vm.result = r[i->a]; return INTERPRET_OK;
+        default        : return INTERPRET_COMPILE_ERROR;
+        }
+    }
+
+#undef register_error
+#undef array_op
+#undef number_op
+}
 
+// Runs jit if there is one and run() otherwise, turning a push past the
+// end of the value stack into a runtime error. Neither checks for room
+// itself: the push faults on the guard page, and the handler jumps back
+// here with whatever was on the stack abandoned.
+static InterpretResult run_guarded(JitCode *jit) {
+    if (sigsetjmp(vm.value_stack.overflow, 0) != 0) {
+        vm.value_stack.armed = false;
+        // Jitted code only brings vm.ip up to date before calling a helper,
+        // so it may not point past any instruction yet
+        if (vm.ip == vm.chunk->code) vm.ip++;
+        vm_error("Stack overflow.");
+        trim_value_stack(&vm.value_stack);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    vm.value_stack.armed = true;
+    InterpretResult result = jit != NULL ? jit_run(jit) : run();
+    vm.value_stack.armed = false;
+    return result;
+}
+
+// Runs a compiled chunk from the start, leaving the value it evaluates to
+// in vm.result
+InterpretResult run_chunk(Chunk *chunk) {
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code;
+    reset_stack();
+
+    if (vm.backend == BACKEND_REGISTER) {
+        if (chunk->registers == NULL) {
+            chunk->registers = compile_registers(chunk);
 #ifdef DEBUG_PRINT_CODE
-    printf("\n=============\nStarting compilation\n\n");
+            if (chunk->registers != NULL) {
+                disassemble_registers(chunk->registers, "registers");
+            }
 #endif
-    if (!compile(source, &chunk)) {
-        free_chunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
+        }
+        if (chunk->registers != NULL) return run_registers(chunk->registers);
+
+        u64 dispatches = vm.stats.dispatches;
+        InterpretResult result = run_guarded(NULL);
+        vm.stats.register_fallbacks++;
+        vm.stats.fallback_dispatches += vm.stats.dispatches - dispatches;
+        return result;
+    } else if (vm.jit_threshold != 0) {
+        if (chunk->jit == NULL && ++chunk->runs == vm.jit_threshold) {
+            chunk->jit = jit_compile(chunk);
+            if (chunk->jit != NULL) vm.stats.jit_compiles++;
+        }
+        if (chunk->jit != NULL) {
+            vm.stats.jit_runs++;
+            return run_guarded(chunk->jit);
+        }
     }
+
+    return run_guarded(NULL);
+}
+
+// Continues running vm.chunk from vm.ip on the current stack, after run()
+// returned INTERPRET_YIELD. Only the stack machine meters fuel, so chunks
+// that have to be resumable run on it regardless of vm.backend.
+InterpretResult resume(void) { return run_guarded(NULL); }
+
+// Runs the chunk compiled from source, taking it from the cache when the
+// same source was seen before. On a miss the source is compiled into
+// scratch, a frozen copy of which goes into the cache. scratch itself is
+// left for the caller to free or reuse.
+static InterpretResult interpret_source(const char *source, Chunk *scratch) {
+    size_t length = strlen(source);
+    u32 hash = hash_string(source, length);
+
+    Chunk *chunk = cache_lookup(&vm.cache, source, length, hash);
+    if (chunk == NULL) {
+#ifdef DEBUG_PRINT_CODE
+        write_cstr(&vm.out, "\n=============\nStarting compilation\n\n");
+#endif
+        if (!compile(source, scratch)) return INTERPRET_COMPILE_ERROR;
 #ifdef DEBUG_PRINT_CODE
-    printf("\nCompilation succesful\n=============\n");
+        write_cstr(&vm.out, "\nCompilation succesful\n=============\n");
 #endif
+        chunk = cache_insert(&vm.cache, source, length, hash, scratch);
+        if (chunk == NULL) chunk = scratch;
+    }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    InterpretResult result = run_chunk(chunk);
+    if (result == INTERPRET_OK) {
+        print_Value(vm.result);
+        write_char(&vm.out, '\n');
+    }
+    return result;
+}
 
-    InterpretResult result = run();
+InterpretResult interpret(const char *source) {
+    Chunk chunk;
+    init_chunk(&chunk);
+
+    InterpretResult result = interpret_source(source, &chunk);
 
     free_chunk(&chunk);
+    flush_writer(&vm.out);
     return result;
 }
 
+// Same as interpret(), but compiles into a chunk that is reused between
+// calls instead of allocating a new one every time. Flushing the output is
+// left to the caller.
+InterpretResult interpret_in(Chunk *chunk, const char *source) {
+    reset_chunk(chunk);
+    return interpret_source(source, chunk);
+}
+
 void push(Value value) {
     *vm.stack_top = value;
     vm.stack_top++;
@@ -0,0 +1,76 @@
+#include "writer.h"
+#include "common.h"
+#include "dtoa.h"
+
+void init_writer(Writer *writer, FILE *file) {
+    writer->file = file;
+    writer->count = 0;
+}
+
+void flush_writer(Writer *writer) {
+    if (writer->count == 0) return;
+    fwrite(writer->buffer, sizeof(char), writer->count, writer->file);
+    fflush(writer->file);
+    writer->count = 0;
+}
+
+void write_bytes(Writer *writer, const char *bytes, size_t length) {
+    if (writer->count + length > WRITER_CAPACITY) {
+        flush_writer(writer);
+        // Anything that wouldn't fit even in an empty buffer goes
+        // straight to the file instead of being split up
+        if (length > WRITER_CAPACITY) {
+            fwrite(bytes, sizeof(char), length, writer->file);
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->count, bytes, length);
+    writer->count += length;
+}
+
+void write_cstr(Writer *writer, const char *string) {
+    write_bytes(writer, string, strlen(string));
+}
+
+void write_number(Writer *writer, double number) {
+    if (writer->count + DTOA_BUFFER_SIZE > WRITER_CAPACITY) {
+        flush_writer(writer);
+    }
+    writer->count += format_double(number, writer->buffer + writer->count);
+}
+
+void write_int(Writer *writer, i64 integer) {
+    // Enough for the 19 digits and sign of INT64_MIN
+    char digits[20];
+    size_t length = 0;
+    // Negated as unsigned, which INT64_MIN survives
+    u64 magnitude = integer < 0 ? 0 - (u64)integer : (u64)integer;
+    do {
+        digits[sizeof(digits) - ++length] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (integer < 0) digits[sizeof(digits) - ++length] = '-';
+    write_bytes(writer, digits + sizeof(digits) - length, length);
+}
+
+void write_fmt(Writer *writer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if (writer->count + length + 1 > WRITER_CAPACITY) flush_writer(writer);
+    if ((size_t)length + 1 > WRITER_CAPACITY) {
+        va_start(args, format);
+        vfprintf(writer->file, format, args);
+        va_end(args);
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(writer->buffer + writer->count, length + 1, format, args);
+    va_end(args);
+    writer->count += length;
+}
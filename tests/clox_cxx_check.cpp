@@ -0,0 +1,37 @@
+// Builds clox.h as C++ and runs a program through the C interface, so that
+// nothing in the public header that only compiles as C gets in unnoticed.
+//
+// Usage: clox_cxx_check
+
+#include "clox.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char *twice(const Value *args, Value *result) {
+    if (args[0].type != VAL_INT) return "twice() wants an integer.";
+    *result = clox_integer(args[0].as.integer * 2);
+    return nullptr;
+}
+
+int main() {
+    clox_init();
+    bool passed = clox_register_native("twice", 1, twice);
+
+    CloxProgram *program = clox_prepare("twice(x) + 1");
+    clox_set_global("x", clox_integer(20));
+    Value result;
+    passed = passed && program != nullptr &&
+             clox_execute(program, &result) == INTERPRET_OK &&
+             result.type == VAL_INT && result.as.integer == 41;
+
+    size_t length = 0;
+    const char *chars = clox_string_chars(clox_string("clox", 4), &length);
+    passed = passed && chars != nullptr && length == 4 &&
+             std::memcmp(chars, "clox", 4) == 0;
+
+    clox_release(program);
+    clox_free();
+    std::puts(passed ? "clox.h works from C++" : "clox.h fails from C++");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+// Checks format_double() against printf on random doubles. The output has
+// to parse back to the same double, and should have the same digits as the
+// shortest %.*e that does, which printf rounds to the closest. Grisu2 misses
+// that for a tiny fraction of inputs, giving longer digits or ones that
+// aren't the closest, so those only fail the check once there are more than
+// MISSES_PER_MILLION of them per million doubles.
+//
+// Usage: dtoa_check [doubles]
+
+#include "dtoa.h"
+
+#define MISSES_PER_MILLION 2000
+
+// The significant digits of a number written in decimal, without leading
+// or trailing zeros. Two numbers that parse to the same double and have the
+// same significant digits are written the same.
+static void significant_digits(const char *text, char *digits) {
+    size_t length = 0;
+    for (const char *c = text; *c != '\0' && *c != 'e'; c++) {
+        if (*c < '0' || *c > '9' || (length == 0 && *c == '0')) continue;
+        digits[length++] = *c;
+    }
+    while (length > 1 && digits[length - 1] == '0') length--;
+    digits[length] = '\0';
+}
+
+// The xorshift64 generator, so that every run checks the same doubles
+static u64 next_random(u64 *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    u64 state = 88172645463325252ull;
+    size_t checked = 0, wrong = 0, longer = 0, farther = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        u64 bits = next_random(&state);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value == 0 || value - value != 0) continue;
+        checked++;
+
+        char formatted[DTOA_BUFFER_SIZE], expected[DTOA_BUFFER_SIZE];
+        format_double(value, formatted);
+        int precision = 0;
+        do {
+            snprintf(expected, sizeof(expected), "%.*e", precision, value);
+        } while (strtod(expected, NULL) != value &&
+                 ++precision < DTOA_MAX_DIGITS);
+
+        char got[DTOA_BUFFER_SIZE], want[DTOA_BUFFER_SIZE];
+        significant_digits(formatted, got);
+        significant_digits(expected, want);
+        if (strtod(formatted, NULL) != value) {
+            if (wrong++ < 10) {
+                printf("%a: got %s, which doesn't round-trip\n", value,
+                       formatted);
+            }
+        } else if (strlen(got) > strlen(want)) {
+            longer++;
+        } else if (strcmp(got, want) != 0) {
+            farther++;
+        }
+    }
+
+    printf("%zu doubles: %zu don't round-trip, %zu are longer than needed "
+           "and %zu aren't the closest\n",
+           checked, wrong, longer, farther);
+    bool passed = wrong == 0 &&
+                  (longer + farther) * 1000000 <= checked * MISSES_PER_MILLION;
+    return passed ? 0 : 1;
+}